@@ -2,7 +2,7 @@
 """
 
 """
-import sys, argparse, subprocess, os, operator
+import sys, argparse, subprocess, os, operator, time
 import ConfigParser
 import tempfile
 
@@ -21,8 +21,56 @@ def parse_args():
     oParser.add_argument('-f', '--fastq',
                          metavar='FILE',
                          dest='fastq',
-                         required=True,
-                         help='REQUIRED: Investigate this fastq file.') 
+                         default=None,
+                         help='REQUIRED (or -w): Investigate this fastq file.') 
+
+    oParser.add_argument('-w', '--watch',
+                         metavar='FOLDER',
+                         dest='watch',
+                         default=None,
+                         help='REQUIRED (or -f): Watch this folder for fastq chunks written during a run and print updated results after each chunk.')
+
+    oParser.add_argument('-i', '--interval',
+                         metavar='SECONDS',
+                         type=int,
+                         dest='interval',
+                         default=30,
+                         help='Look for new chunks this often in watch mode. [default: 30]')
+
+    oParser.add_argument('-s', '--stop',
+                         metavar='SECONDS',
+                         type=int,
+                         dest='stop',
+                         default=3600,
+                         help='Stop watching after this long without a new chunk. [default: 3600]')
+
+    oParser.add_argument('-q', '--minqual',
+                         metavar='PHRED',
+                         type=int,
+                         dest='minqual',
+                         default=0,
+                         help='Skip kmers that contain a base with a quality below this. [default: 0 (off)]')
+
+    oParser.add_argument('-t', '--trimqual',
+                         metavar='PHRED',
+                         type=int,
+                         dest='trimqual',
+                         default=0,
+                         help='Trim bases with a quality below this off both read ends first. [default: 0 (off)]')
+
+    oParser.add_argument('-k', '--top',
+                         metavar='K',
+                         type=int,
+                         dest='top',
+                         default=0,
+                         help='Only report the K most similar reference genomes. Genomes that can not make it into the top K are not compared to the end. [default: 0 (all)]')
+
+    oParser.add_argument('-m', '--minsim',
+                         metavar='PERCENT',
+                         type=float,
+                         dest='minsim',
+                         default=5.0,
+                         help='With a Bloom tree index, only groups with a centroid of at least this similarity are candidates. If there is none, all centroids are compared. [default: 5.0]')
 
     oParser.add_argument('-c', '--config',
                          metavar='FILE',
@@ -36,6 +84,10 @@ def parse_args():
                          help='Do not investigate sample for mixing. [default: Investigate. (Takes about 2 minutes.)]')    
 
     oArgs = oParser.parse_args()
+
+    if (oArgs.fastq == None) == (oArgs.watch == None):
+        oParser.error("exactly one of -f/--fastq and -w/--watch is required")
+
     return oArgs, oParser
 
 # ---------------------------------------------------------------
@@ -45,20 +97,23 @@ def main():
 
     oConf = ConfigParser.RawConfigParser()
     oConf.read(oArgs.config)
+
+    if oArgs.watch != None:
+        watchRun(os.path.abspath(oArgs.watch), oConf, oArgs.interval, oArgs.stop, oArgs.minqual, oArgs.trimqual)
+        return
         
     # create kmer list for sample reads
     fTmpFile = tempfile.NamedTemporaryFile()
-    createReadKmerList(os.path.abspath(oArgs.fastq), fTmpFile)
+    createReadKmerList(os.path.abspath(oArgs.fastq), fTmpFile, oArgs.minqual, oArgs.trimqual)
  
-    dTestGenera = determineTestGenera(fTmpFile, oConf)     
+    dTestGenera = determineTestGenera(fTmpFile, oConf, oArgs.minsim)     
     
-    aResults = determineExactMatch(dTestGenera, fTmpFile, oConf)
+    aResults = determineExactMatch(dTestGenera, fTmpFile, oConf, oArgs.top)
     
-    sys.stdout.write("#Kmer based similarities\n#similarity\tgroups\tfile\n")
-    for aRes in aResults:
-        sys.stdout.write("%f\t%s\t%s\n" % (aRes[0], aRes[3], aRes[4]))
+    writeResults(aResults)
 
-    if oArgs.nomix == False:
+    # the mixing analysis needs at least one genome besides the top hit
+    if oArgs.nomix == False and len(aResults) > 1:
         checkMixing(aResults, fTmpFile, oConf)
     
     fTmpFile.close()
@@ -67,8 +122,9 @@ def main():
 
 # end of main ---------------------------------------------------------------
 
-def createReadKmerList(sFastq, fFile):
-    sCmd = "cat %s | sed -n '2~4p' | bin/kmer_reads_process_stdin 18 > %s" % (sFastq, fFile.name)
+def createReadKmerList(sFastq, fFile, iMinQual, iTrimQual):
+    # the whole fastq goes in so the base qualities can be used
+    sCmd = "cat %s | bin/kmer_reads_process_stdin -f -q %i -t %i 18 > %s" % (sFastq, iMinQual, iTrimQual, fFile.name)
     if sFastq.endswith('.gz') == True:
         sCmd = "z" + sCmd 
     p = subprocess.Popen(sCmd, shell=True, stdin=None,stdout=subprocess.PIPE, stderr=subprocess.PIPE, close_fds=True)
@@ -77,7 +133,7 @@ def createReadKmerList(sFastq, fFile):
 
 # ---------------------------------------------------------------
 
-def determineTestGenera(fFile, oConf):
+def determineTestGenera(fFile, oConf, flMinSim):
 
     aGenusResults = []    
     sCmd2 = "bin/intersect_kmer_lists_filelist " + fFile.name
@@ -93,6 +149,23 @@ def determineTestGenera(fFile, oConf):
             sCmd2 += " %s%s%s_kmers.txt" % (sFolder, os.sep, sCent)
             dFileToGroup["%s%s%s_kmers.txt" % (sFolder, os.sep, sCent)] = sGen
 
+    # the Bloom tree only opens the subtrees that can hold a centroid with
+    # at least flMinSim similarity. if there is none, or the index can not
+    # be used, all centroids are compared.
+    sIndex = getSbtIndex(oConf, dFileToGroup.keys())
+    if sIndex != None:
+        sCmd3 = "bin/kmer_sbt_query %s %s 5 %f" % (sIndex, fFile.name, flMinSim)
+        p = subprocess.Popen(sCmd3, shell=True, stdin=None, stdout=subprocess.PIPE, stderr=subprocess.PIPE, close_fds=True)
+        (sOut, sErr) = p.communicate()
+        if p.returncode != 0:
+            sys.stderr.write("WARNING: Bloom tree index not used: %s\n" % sErr.strip())
+        else:
+            for sLine in sOut.splitlines():
+                aCols = [x.strip() for x in sLine.strip().split("\t")]
+                aGenusResults.append([float(aCols[0]), aCols[1], aCols[2]])
+            if len(aGenusResults) > 0:
+                return pickTestGenera(aGenusResults, dFileToGroup)
+
     p = subprocess.Popen(sCmd2, shell=True, stdin=None, stdout=subprocess.PIPE, stderr=subprocess.PIPE, close_fds=True)
     aOutLines = p.stdout.readlines()        
     for sLine in aOutLines:
@@ -101,43 +174,73 @@ def determineTestGenera(fFile, oConf):
         aGenusResults.append([float(aCols[0]), aCols[1], aCols[2]])
     p.stdout.close()    
 
+    return pickTestGenera(aGenusResults, dFileToGroup)
+
+# ------------------------------------------------------------------------------
+
+def pickTestGenera(aGenusResults, dFileToGroup):
+
     # sort results descendingly by similarity value
     aGenusResults.sort(key=operator.itemgetter(0))
     aGenusResults.reverse()
     
     dTestGenera = {}    
-    # for each genus in the x highest hits
+    # for each genus in the x highest hits keep its best centroid similarity
     for aHighHitGenusResult in aGenusResults[0:5]:
         # get name of similarity file
         sHighHitFolder = aHighHitGenusResult[2]
-        dTestGenera[dFileToGroup[sHighHitFolder]] = 1    
+        if dTestGenera.has_key(dFileToGroup[sHighHitFolder]) == False:
+            dTestGenera[dFileToGroup[sHighHitFolder]] = aHighHitGenusResult[0]
 
     return dTestGenera
 
 # ------------------------------------------------------------------------------
 
-def determineExactMatch(dTestGenera, fFile, oConf):
+def getSbtIndex(oConf, aCentroidFiles):
+    # only use the index if it was built over exactly the current centroids
+    try:
+        sIndex = oConf.get('sbt', 'index')
+        aLeaves = oConf.get('sbt', 'leaves').split(",")
+    except (ConfigParser.NoSectionError, ConfigParser.NoOptionError):
+        return None
+    if os.path.exists(sIndex) == False:
+        return None
+    if sorted(aLeaves) != sorted(aCentroidFiles):
+        return None
+    return sIndex
+
+# ------------------------------------------------------------------------------
+
+def determineExactMatch(dTestGenera, fFile, oConf, iTop):
     
     aResults = []
     dFileToGroup = {}
-    # iterate over the genera to determine closest genome
-    for sGen in dTestGenera.keys():
-        
-        sCmd3 = "bin/intersect_kmer_lists_filelist " + fFile.name
-        sRefSec = '%s_refset' % sGen
-        aRefs  = oConf.options(sRefSec)
+    aRefFiles = []
+    # one run over the genera ordered by their best centroid, centroids first
+    # within each, so that with --top the likely best genomes set the bar early
+    for sGen in sorted(dTestGenera.keys(), key=lambda x: dTestGenera[x], reverse=True):
         sFolder = oConf.get('group_folders', sGen)
-        for sRefNum in aRefs:
-            sRef= oConf.get(sRefSec, sRefNum)
-            sCmd3 += " %s%s%s_kmers.txt" % (sFolder, os.sep, sRef)
-            dFileToGroup["%s%s%s_kmers.txt" % (sFolder, os.sep, sRef)] = sGen
-        p = subprocess.Popen(sCmd3, shell=True, stdin=None, stdout=subprocess.PIPE, close_fds=True)
-        aOutLines = p.stdout.readlines()
-        for sLine in aOutLines:
-            sLine = sLine.strip()
-            aCols = [x.strip() for x in sLine.split("\t")]
-            aResults.append([float(aCols[0]), aCols[1], aCols[2]])
-        p.stdout.close()
+        sRefSec = '%s_refset' % sGen
+        aRefs = [oConf.get(sRefSec, sRefNum) for sRefNum in oConf.options(sRefSec)]
+        sCentSec = '%s_centroids' % sGen
+        aCents = [oConf.get(sCentSec, sCenNum) for sCenNum in oConf.options(sCentSec)]
+        aRefs = [x for x in aRefs if x in aCents] + [x for x in aRefs if x not in aCents]
+        for sRef in aRefs:
+            sFile = "%s%s%s_kmers.txt" % (sFolder, os.sep, sRef)
+            aRefFiles.append(sFile)
+            dFileToGroup[sFile] = sGen
+
+    sCmd3 = "bin/intersect_kmer_lists_filelist "
+    if iTop > 0:
+        sCmd3 += "--top %i " % iTop
+    sCmd3 += fFile.name + " " + " ".join(aRefFiles)
+    p = subprocess.Popen(sCmd3, shell=True, stdin=None, stdout=subprocess.PIPE, close_fds=True)
+    aOutLines = p.stdout.readlines()
+    for sLine in aOutLines:
+        sLine = sLine.strip()
+        aCols = [x.strip() for x in sLine.split("\t")]
+        aResults.append([float(aCols[0]), aCols[1], aCols[2]])
+    p.stdout.close()
         
     # sort results array and write out results
     aResults.sort(key=operator.itemgetter(0))
@@ -151,6 +254,149 @@ def determineExactMatch(dTestGenera, fFile, oConf):
 
 # ------------------------------------------------------------------------------
 
+def writeResults(aResults):
+    sys.stdout.write("#Kmer based similarities\n#similarity\tgroups\tfile\n")
+    for aRes in aResults:
+        sys.stdout.write("%f\t%s\t%s\n" % (aRes[0], aRes[3], aRes[4]))
+    sys.stdout.flush()
+    return
+
+# ------------------------------------------------------------------------------
+
+def watchRun(sWatchFolder, oConf, iInterval, iStop, iMinQual, iTrimQual):
+
+    # one long running process keeps the kmer state of the sample and the
+    # centroid kmer lists in memory and is fed one chunk after the other.
+    # the refset lists of a group are only added once it becomes a candidate.
+    dFileToGroup = {}
+    aCentroids = []
+    dRefsets = {}
+    for sGen in oConf.options('group_folders'):
+        sFolder = oConf.get('group_folders', sGen)
+        sCentSec = '%s_centroids' % sGen
+        for sCenNum in oConf.options(sCentSec):
+            sFile = "%s%s%s_kmers.txt" % (sFolder, os.sep, oConf.get(sCentSec, sCenNum))
+            aCentroids.append(sFile)
+            dFileToGroup[sFile] = sGen
+        sRefSec = '%s_refset' % sGen
+        dRefsets[sGen] = []
+        for sRefNum in oConf.options(sRefSec):
+            sFile = "%s%s%s_kmers.txt" % (sFolder, os.sep, oConf.get(sRefSec, sRefNum))
+            dRefsets[sGen].append(sFile)
+            dFileToGroup[sFile] = sGen
+
+    oProc = subprocess.Popen(["bin/kmer_reads_watch", "-f", "-q", str(iMinQual), "-t", str(iTrimQual), "18"] + sorted(aCentroids), stdin=subprocess.PIPE, stdout=subprocess.PIPE, close_fds=True)
+
+    aFastqEndings = (".fastq", ".fq", ".fastq.gz", ".fq.gz")
+    dSizes = {}
+    dDone = {}
+    flLastChunk = time.time()
+    try:
+        while time.time() - flLastChunk < iStop:
+            for sChunk in sorted(os.listdir(sWatchFolder)):
+                sPath = os.path.join(sWatchFolder, sChunk)
+                if sChunk.endswith(aFastqEndings) == False or dDone.has_key(sChunk) == True:
+                    continue
+                # only pick up chunks that did not grow since the last look
+                iSize = os.path.getsize(sPath)
+                if dSizes.get(sChunk) != iSize:
+                    dSizes[sChunk] = iSize
+                    continue
+
+                (iSolid, dSims) = addChunk(oProc, sPath)
+                dDone[sChunk] = 1
+                flLastChunk = time.time()
+
+                aGenusResults = [[dSims[s], 100.0 - dSims[s], s] for s in aCentroids]
+                dTestGenera = pickTestGenera(aGenusResults, dFileToGroup)
+                aResults = []
+                for sGen in dTestGenera.keys():
+                    for sFile in dRefsets[sGen]:
+                        if dSims.has_key(sFile) == False:
+                            dSims[sFile] = addRef(oProc, sFile)
+                        aResults.append([dSims[sFile], 100.0 - dSims[sFile], sFile, sGen,
+                                         os.path.basename(sFile).replace("_kmers.txt", "")])
+                aResults.sort(key=operator.itemgetter(0))
+                aResults.reverse()
+
+                sys.stdout.write("#Chunk: %s\tchunks: %i\tsolid kmers: %i\n" % (sChunk, len(dDone), iSolid))
+                writeResults(aResults)
+                sys.stdout.write("\n")
+            time.sleep(iInterval)
+    except KeyboardInterrupt:
+        pass
+
+    oProc.stdin.close()
+    oProc.wait()
+    return
+
+# ------------------------------------------------------------------------------
+
+def addChunk(oProc, sChunk):
+
+    # the fastq records go straight into the watch process, followed by the chunk marker
+    sCmd = "cat %s" % (sChunk)
+    if sChunk.endswith('.gz') == True:
+        sCmd = "z" + sCmd
+    p = subprocess.Popen(sCmd, shell=True, stdin=None, stdout=oProc.stdin, close_fds=True)
+    p.wait()
+    try:
+        oProc.stdin.write("#\n")
+        oProc.stdin.flush()
+    except IOError:
+        watchFailed(oProc)
+
+    aLines = readWatchAnswer(oProc)
+    iSolid = int(aLines[0].split("\t")[2])
+    dSims = {}
+    for sLine in aLines[1:]:
+        aCols = [x.strip() for x in sLine.split("\t")]
+        dSims[aCols[2]] = float(aCols[0])
+
+    return (iSolid, dSims)
+
+# ------------------------------------------------------------------------------
+
+def addRef(oProc, sFile):
+
+    # the watch process loads the list, compares it against all solid kmers so
+    # far and from then on keeps its count up to date with every chunk
+    try:
+        oProc.stdin.write("#add %s\n" % (sFile))
+        oProc.stdin.flush()
+    except IOError:
+        watchFailed(oProc)
+
+    aLines = readWatchAnswer(oProc)
+    return float(aLines[0].split("\t")[0])
+
+# ------------------------------------------------------------------------------
+
+def readWatchAnswer(oProc):
+
+    # the lines the watch process prints for a chunk or a new list, up to the
+    # closing '//'. it only closes its output when it stopped.
+    aLines = []
+    for sLine in iter(oProc.stdout.readline, ""):
+        sLine = sLine.strip()
+        if sLine == "//":
+            return aLines
+        aLines.append(sLine)
+
+    watchFailed(oProc)
+
+# ------------------------------------------------------------------------------
+
+def watchFailed(oProc):
+
+    # its own error message, e.g. on a kmer list it can not open, is already
+    # on stderr
+    iRet = oProc.wait()
+    sys.stderr.write("ERROR: bin/kmer_reads_watch exited with code %i, watching stopped.\n" % iRet)
+    sys.exit(1)
+
+# ------------------------------------------------------------------------------
+
 def checkMixing(aRes, fFile, oConf):
 
     oOut = sys.stdout
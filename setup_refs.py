@@ -3,11 +3,8 @@
 
 
 """
-import sys, argparse, os, glob, subprocess
+import sys, argparse, os, glob, subprocess, math, struct, array
 import ConfigParser
-from scipy.cluster.hierarchy import linkage
-from scipy.cluster.hierarchy import fcluster
-from scipy.spatial.distance import squareform
 
 __version__= '0.1'
 __date__= '12Feb2014'
@@ -39,6 +36,35 @@ def parse_args():
                          required=True,
                          help='REQUIRED: Configuration file. Usually config/config.cnf.')
 
+    oParser.add_argument('-s', '--sbt',
+                         action='store_true',
+                         dest='sbt',
+                         help='(Re)build the Bloom tree index over the centroids of all groups in the config file. [default: no]')
+
+    oParser.add_argument('-b', '--sbtbits',
+                         metavar='INT',
+                         type=int,
+                         dest='sbtbits',
+                         default=32,
+                         help='No Bloom filter in the index has more than 2^INT bits. [default: 32 (512MB)]')
+
+    oParser.add_argument('-a', '--approx',
+                         action='store_true',
+                         dest='approx',
+                         help='Estimate the similarity matrix from MinHash sketches instead of computing it exactly. [default: exact]')
+
+    oParser.add_argument('-z', '--sketchsize',
+                         metavar='INT',
+                         type=int,
+                         dest='sketchsize',
+                         default=5000,
+                         help='Number of hashes per genome sketch with --approx. [default: 5000]')
+
+    oParser.add_argument('-r', '--refine',
+                         action='store_true',
+                         dest='refine',
+                         help='With --approx, compute the similarities of genomes near cluster boundaries exactly and cluster again. [default: no]')
+
     oArgs = oParser.parse_args()
     return oArgs, oParser
 
@@ -86,7 +112,7 @@ def main():
                 p.wait()
                 sFile = sFile[:-3]
 
-            sCmd = "bin/kmer_refset_process %i %s > %s" % (18, sFile, sKmerList)
+            sCmd = "bin/kmer_refset_process %i %s %s.len > %s" % (18, sFile, sKmerList, sKmerList)
             p = subprocess.Popen(sCmd, shell=True, stdin=None, stdout=subprocess.PIPE, stderr=subprocess.PIPE, close_fds=True)
             stdout_write("Calculating kmer list for %s ..." % sFile)
             p.wait()
@@ -99,20 +125,47 @@ def main():
         else:
             stdout_write("%s - kmer list found. skipping creation." % sKmerList)
             aKmerLists.append(sKmerList)
+            write_kmer_count(sKmerList)
 
     stdout_write("%i kmer lists made or found." % len(aKmerLists))
 
     sSimMatFile = "config%s%s_simmat.tsv" % (os.sep, oArgs.name)
+
+    # how the matrix is made: 'exact' or 'approx,<sketch size>'. an existing
+    # matrix is only reused if it was made the same way.
+    sMode = "exact"
+    if oArgs.approx == True:
+        sMode = "approx,%i" % oArgs.sketchsize
+    elif oArgs.refine == True:
+        stdout_write("WARNING: -r/--refine is ignored without -a/--approx")
+
+    gCreate = True
+    flMaxErr = None
     if os.path.exists(sSimMatFile) == True:
         (c, r) = get_mat_dims(sSimMatFile)
-        if c == len(aKmerLists) + 1 and c==r:
+        (sOldMode, flOldMaxErr) = get_mat_mode(oConf, oArgs.name)
+        # a matrix of the right size for a different set of genomes is made again
+        aGenomes = sorted([os.path.basename(x).replace("_kmers.txt", "") for x in aKmerLists])
+        if c == len(aKmerLists) + 1 and c==r and sorted(get_mat_names(sSimMatFile)) != aGenomes:
+            stdout_write("found similarity matrix for reference group %s for other genomes, creating it again ..." % oArgs.name)
+        elif c == len(aKmerLists) + 1 and c==r and sOldMode == sMode:
             stdout_write("found similarity matrix for reference group %s, skipping creation ..." % oArgs.name)
-        else:
-            stdout_write("creating similarity matrix for reference group %s ..." % oArgs.name)
-            create_sim_matrix(aKmerLists, sSimMatFile)
-    else:
+            gCreate = False
+            flMaxErr = flOldMaxErr
+        elif c == len(aKmerLists) + 1 and c==r:
+            stdout_write("found similarity matrix for reference group %s made as '%s', creating it again as '%s' ..." % (oArgs.name, sOldMode, sMode))
+
+    if gCreate == True and oArgs.approx == True:
+        stdout_write("estimating similarity matrix for reference group %s from sketches ..." % oArgs.name)
+        flMaxErr = create_approx_sim_matrix(aKmerLists, sSimMatFile, oArgs.sketchsize)
+    elif gCreate == True:
         stdout_write("creating similarity matrix for reference group %s ..." % oArgs.name)
         create_sim_matrix(aKmerLists, sSimMatFile)
+    elif flMaxErr != None:
+        stdout_write("estimated standard error of the similarities: max %f" % flMaxErr)
+
+    if oArgs.approx == True and oArgs.refine == True and flMaxErr == None:
+        stdout_write("WARNING: the error of the estimated matrix is not known, -r/--refine is ignored. Delete %s to estimate it again." % sSimMatFile)
 
     stdout_write("Created sim mat file: %s" % sSimMatFile)
 
@@ -121,9 +174,20 @@ def main():
     except ConfigParser.DuplicateSectionError:
         pass
     oConf.set('matrices', oArgs.name, sSimMatFile)
+    set_mat_mode(oConf, oArgs.name, sMode, flMaxErr)
 
-    d3Cl = cluster_group(sSimMatFile, 3)
-    d3Cen = get_centroids(d3Cl, sSimMatFile)
+    # pairs computed exactly during refinement, shared between both cuts
+    dExact = {}
+
+    aClusterCounts = [3]
+    if len(aFileList) > 40:
+        aClusterCounts.append(40)
+    dClusterings = cluster_group(sSimMatFile, aClusterCounts)
+    if flMaxErr != None and oArgs.refine == True:
+        for iClusters in aClusterCounts:
+            dClusterings = refine_boundaries(dClusterings, iClusters, sSimMatFile, aKmerLists, 2.0 * flMaxErr, dExact)
+
+    d3Cen = dClusterings[3][1]
 
     try:
         oConf.add_section('%s_centroids' % oArgs.name)
@@ -133,8 +197,7 @@ def main():
         oConf.set('%s_centroids' % oArgs.name, str(k), d3Cen[k])
 
     if len(aFileList) > 40:
-        d40Cl = cluster_group(sSimMatFile, 40)
-        d40Cen = get_centroids(d40Cl, sSimMatFile)
+        d40Cen = dClusterings[40][1]
         try:
             oConf.add_section('%s_refset' % oArgs.name)
         except ConfigParser.DuplicateSectionError:
@@ -150,6 +213,10 @@ def main():
         for i in range(1, len(aGenomes)+1):
             oConf.set('%s_refset' % oArgs.name, str(i),aGenomes[i-1])
 
+    if oArgs.sbt == True:
+        stdout_write("building Bloom tree index over all groups ...")
+        build_sbt_index(oConf, oArgs.sbtbits)
+
     fCnf = open(sConfFile, 'w')
     oConf.write(fCnf)
     fCnf.close()
@@ -165,6 +232,25 @@ def stdout_write(s):
 
 # ---------------------------------------------------------------
 
+def write_kmer_count(sKmerList):
+    # the number of kmers next to the list lets kmerid -k skip lists early.
+    # kmer_refset_process writes it for new lists, older ones get it here.
+    sLenFile = sKmerList + ".len"
+    if os.path.exists(sLenFile) == True and os.path.getmtime(sLenFile) >= os.path.getmtime(sKmerList):
+        return
+    f = open(sKmerList, 'r')
+    iNofKmers = 0
+    for s in f:
+        if s.strip() != "":
+            iNofKmers += 1
+    f.close()
+    f = open(sLenFile, 'w')
+    f.write("%i\n" % iNofKmers)
+    f.close()
+    return
+
+# ---------------------------------------------------------------
+
 def create_sim_matrix(aFiles, sSimMat):
 
     fOut = open(sSimMat, 'w')
@@ -189,11 +275,7 @@ def create_sim_matrix(aFiles, sSimMat):
                 try:
                     fOut.write("\t%f" % (d[k2]))
                 except KeyError:
-                    sCmd = "bin/kmer_jaccard_index %s %s" % (aFiles[i], aFiles[j])
-                    p = subprocess.Popen(sCmd, shell=True, stdin=None, stdout=subprocess.PIPE, close_fds=True)
-                    # get output from subprocess
-                    sOutLine = p.stdout.readline()
-                    flSim = float(sOutLine.split("\t")[0])
+                    flSim = exact_jaccard(aFiles[i], aFiles[j])
                     fOut.write("\t%f" % (flSim))
                     d[k1] = flSim
 
@@ -204,6 +286,226 @@ def create_sim_matrix(aFiles, sSimMat):
 
 # ---------------------------------------------------------------
 
+def exact_jaccard(sFile1, sFile2):
+
+    sCmd = "bin/kmer_jaccard_index %s %s" % (sFile1, sFile2)
+    p = subprocess.Popen(sCmd, shell=True, stdin=None, stdout=subprocess.PIPE, close_fds=True)
+    # get output from subprocess
+    sOutLine = p.stdout.readline()
+    p.stdout.close()
+    p.wait()
+    return float(sOutLine.split("\t")[0])
+
+# ---------------------------------------------------------------
+
+def create_approx_sim_matrix(aFiles, sSimMat, iSketchSize):
+
+    iNofFiles = len(aFiles)
+    aNames = [os.path.basename(x).replace("_kmers.txt", "") for x in aFiles]
+    dIdx = {}
+    for i in range(0, iNofFiles):
+        dIdx[aFiles[i]] = i
+
+    aaSim = [[1.0] * iNofFiles for i in range(0, iNofFiles)]
+
+    # all pairs in one go, every kmer list is only read once
+    sCmd = "bin/kmer_sketch_jaccard %i %s" % (iSketchSize, " ".join(aFiles))
+    p = subprocess.Popen(sCmd, shell=True, stdin=None, stdout=subprocess.PIPE, close_fds=True)
+    flSumErr = 0.0
+    flMaxErr = 0.0
+    iNofPairs = 0
+    for sLine in p.stdout:
+        aCols = [x.strip() for x in sLine.split("\t")]
+        (i, j) = (dIdx[aCols[1]], dIdx[aCols[2]])
+        flSim = float(aCols[0])
+        aaSim[i][j] = flSim
+        aaSim[j][i] = flSim
+        # standard error of a bottom-s MinHash estimate
+        flErr = math.sqrt(flSim * (1.0 - flSim) / iSketchSize)
+        flSumErr += flErr
+        flMaxErr = max(flMaxErr, flErr)
+        iNofPairs += 1
+    p.stdout.close()
+    p.wait()
+
+    write_sim_matrix(aNames, aaSim, sSimMat)
+
+    if iNofPairs > 0:
+        stdout_write("estimated standard error of the similarities: mean %f, max %f" % (flSumErr / iNofPairs, flMaxErr))
+    return flMaxErr
+
+# ---------------------------------------------------------------
+
+def read_sim_matrix(sFile):
+
+    f = open(sFile, 'r')
+    aNames = f.readline().strip().split("\t")
+    aaSim = []
+    for s in f:
+        aaSim.append([float(x) for x in s.strip().split("\t")[1:]])
+    f.close()
+    return (aNames, aaSim)
+
+# ---------------------------------------------------------------
+
+def write_sim_matrix(aNames, aaSim, sFile):
+
+    fOut = open(sFile, 'w')
+    for s in aNames:
+        fOut.write("\t%s" % (s))
+    fOut.write("\n")
+    for i in range(0, len(aNames)):
+        fOut.write(aNames[i])
+        for j in range(0, len(aNames)):
+            if i==j:
+                fOut.write("\t1.0")
+            else:
+                fOut.write("\t%f" % (aaSim[i][j]))
+        fOut.write("\n")
+    fOut.close()
+    return
+
+# ---------------------------------------------------------------
+
+def refine_boundaries(dClusterings, iClusters, sSimMatFile, aFiles, flMargin, dExact):
+
+    # a genome is near a boundary if its average similarity to the rest of its
+    # own cluster is not clearly higher than to the closest other cluster.
+    # its similarities to both clusters are then computed exactly and the
+    # group clustered again.
+    (aNames, aaSim) = read_sim_matrix(sSimMatFile)
+    iNofFiles = len(aNames)
+    dIdx = {}
+    for i in range(0, iNofFiles):
+        dIdx[aNames[i]] = i
+    # the rows of the matrix are not necessarily in the order of aFiles
+    dNameToFile = {}
+    for sFile in aFiles:
+        dNameToFile[os.path.basename(sFile).replace("_kmers.txt", "")] = sFile
+    dClusters = dClusterings[iClusters][0]
+    dMembers = {}
+    for k in dClusters.keys():
+        dMembers[k] = [dIdx[x] for x in dClusters[k]]
+
+    aBoundary = []
+    aPairs = []
+    for k in dMembers.keys():
+        if len(dMembers[k]) < 2:
+            continue
+        for i in dMembers[k]:
+            flOwn = sum([aaSim[i][j] for j in dMembers[k] if j != i]) / float(len(dMembers[k]) - 1)
+            flOther = 0.0
+            kNearest = None
+            for k2 in dMembers.keys():
+                if k2 != k:
+                    flAvg = sum([aaSim[i][j] for j in dMembers[k2]]) / float(len(dMembers[k2]))
+                    if kNearest == None or flAvg > flOther:
+                        (flOther, kNearest) = (flAvg, k2)
+            if kNearest == None or flOwn - flOther >= flMargin:
+                continue
+            aBoundary.append(i)
+            for j in dMembers[k] + dMembers[kNearest]:
+                if i != j and dExact.has_key((min(i, j), max(i, j))) == False:
+                    dExact[(min(i, j), max(i, j))] = 1
+                    aPairs.append((i, j))
+
+    # all pairs in one go, every boundary genome is only loaded once
+    iNofPairs = 0
+    if len(aPairs) > 0:
+        sPairs = "".join(["%s\t%s\n" % (dNameToFile[aNames[i]], dNameToFile[aNames[j]]) for (i, j) in aPairs])
+        p = subprocess.Popen("bin/kmer_jaccard_index -p", shell=True, stdin=subprocess.PIPE, stdout=subprocess.PIPE, close_fds=True)
+        (sOut, sErr) = p.communicate(sPairs)
+        dFileToIdx = {}
+        for i in range(0, iNofFiles):
+            dFileToIdx[dNameToFile[aNames[i]]] = i
+        for sLine in sOut.splitlines():
+            aCols = [x.strip() for x in sLine.split("\t")]
+            (i, j) = (dFileToIdx[aCols[1]], dFileToIdx[aCols[2]])
+            flSim = float(aCols[0])
+            aaSim[i][j] = flSim
+            aaSim[j][i] = flSim
+            iNofPairs += 1
+
+    stdout_write("%i genomes near the boundaries of %i clusters, %i pairs refined exactly" % (len(aBoundary), iClusters, iNofPairs))
+    if iNofPairs == 0:
+        return dClusterings
+
+    write_sim_matrix(aNames, aaSim, sSimMatFile)
+    return cluster_group(sSimMatFile, dClusterings.keys())
+
+# ---------------------------------------------------------------
+
+def build_sbt_index(oConf, iLog2Bits):
+
+    sIndex = "config%srefs.sbt" % (os.sep)
+    aGroups = sorted(oConf.options('group_folders'))
+
+    aLeaves = []
+    for sGroup in aGroups:
+        sCentSec = '%s_centroids' % sGroup
+        sFolder = oConf.get('group_folders', sGroup)
+        for sCenNum in oConf.options(sCentSec):
+            aLeaves.append("%s%s%s_kmers.txt" % (sFolder, os.sep, oConf.get(sCentSec, sCenNum)))
+
+    # build into a temporary file so that a failed build leaves nothing
+    # behind that kmerid could mistake for an index
+    sTmpIndex = sIndex + ".tmp"
+    sCmd = "bin/kmer_sbt_build %i %s %s" % (iLog2Bits, sTmpIndex, " ".join(aLeaves))
+
+    p = subprocess.Popen(sCmd, shell=True, stdin=None, stdout=subprocess.PIPE, stderr=subprocess.PIPE, close_fds=True)
+    (sOut, sErr) = p.communicate()
+    if p.returncode != 0:
+        if os.path.exists(sTmpIndex) == True:
+            os.remove(sTmpIndex)
+        stdout_write("ERROR: building the Bloom tree index failed, no index is used: %s" % sErr.strip())
+        return
+
+    os.rename(sTmpIndex, sIndex)
+    try:
+        oConf.add_section('sbt')
+    except ConfigParser.DuplicateSectionError:
+        pass
+    oConf.set('sbt', 'index', sIndex)
+    oConf.set('sbt', 'leaves', ",".join(aLeaves))
+
+    stdout_write("Created Bloom tree index: %s" % sIndex)
+    return
+
+# ---------------------------------------------------------------
+
+def get_mat_mode(oConf, sName):
+    # matrices from before the mode was recorded are exact
+    try:
+        aMode = oConf.get('matrix_modes', sName).split(",")
+    except (ConfigParser.NoSectionError, ConfigParser.NoOptionError):
+        return ("exact", None)
+    flMaxErr = None
+    if len(aMode) > 2:
+        flMaxErr = float(aMode[2])
+    return (",".join(aMode[0:2]), flMaxErr)
+
+# ---------------------------------------------------------------
+
+def set_mat_mode(oConf, sName, sMode, flMaxErr):
+    try:
+        oConf.add_section('matrix_modes')
+    except ConfigParser.DuplicateSectionError:
+        pass
+    if flMaxErr != None:
+        sMode += ",%f" % flMaxErr
+    oConf.set('matrix_modes', sName, sMode)
+    return
+
+# ---------------------------------------------------------------
+
+def get_mat_names(sFile):
+    f = open(sFile, 'r')
+    aNames = f.readline().strip().split("\t")
+    f.close()
+    return aNames
+
+# ---------------------------------------------------------------
+
 def get_mat_dims(sFile):
     f = open(sFile, 'r')
     a = []
@@ -218,67 +520,53 @@ def get_mat_dims(sFile):
 
 # ---------------------------------------------------------------
 
-def cluster_group(sFile, iClusters):
+def cluster_group(sFile, aClusterCounts):
+
+    # average linkage clustering and centroids for all cluster counts in one
+    # go. returns {count: ({cluster: [genomes]}, {cluster: centroid})}
+    sBinFile = write_binary_matrix(sFile)
 
     f = open(sFile, 'r')
-    a = []
-    aLines = []
-    for s in f:
-        aLines.append(s.strip())
+    aNames = f.readline().strip().split("\t")
     f.close()
 
-    aNames = aLines[0].strip().split("\t")
-    for sL in aLines[1:]:
-        a.append([1.0-float(x) for x in sL.split("\t")[1:]])
+    sCmd = "bin/kmer_cluster %s %s" % (sBinFile, " ".join([str(k) for k in aClusterCounts]))
+    p = subprocess.Popen(sCmd, shell=True, stdin=None, stdout=subprocess.PIPE, close_fds=True)
 
-    linkage_matrix = linkage(squareform(a), method='average')
-    cluster = fcluster(linkage_matrix, float(iClusters), criterion='maxclust')
-
-    dClus = {}
-    for x in range(0, len(cluster)):
-        clusnum = cluster[x]
+    dClusterings = {}
+    for k in aClusterCounts:
+        dClusterings[k] = ({}, {})
+    for sLine in p.stdout:
+        (k, x, clusnum, iCentroid) = [int(s) for s in sLine.strip().split("\t")]
+        (dClus, dCentroids) = dClusterings[k]
         try:
             dClus[clusnum].append(aNames[x])
         except KeyError:
             dClus[clusnum] = [aNames[x]]
+        if iCentroid == 1:
+            dCentroids[clusnum] = aNames[x]
+    p.stdout.close()
+    p.wait()
 
-    return dClus
+    return dClusterings
 
 # ---------------------------------------------------------------
 
-def get_centroids(dClusters, sSimMatFile):
-
-    fMat = open(sSimMatFile, 'r')
-    aaSimMatrix = []
-    for sLine in fMat:
-        aaSimMatrix.append([x.strip() for x in sLine.split("\t")])
-    fMat.close()
+def write_binary_matrix(sFile):
 
-    aNames = aaSimMatrix[0][1:]
-    dSimMatrix = {}
-    for aLine in aaSimMatrix[1:]:
-        sName = aLine[0]
-        dSimMatrix[sName] = {}
-        for i in range(1, len(aLine)):
-            dSimMatrix[sName][aNames[i-1]] = float(aLine[i])
+    # int n followed by n*n doubles, one row at a time
+    sBinFile = os.path.splitext(sFile)[0] + ".bin"
 
-    dCentroids = {}
+    f = open(sFile, 'r')
+    aNames = f.readline().strip().split("\t")
+    fOut = open(sBinFile, 'wb')
+    fOut.write(struct.pack('i', len(aNames)))
+    for s in f:
+        array.array('d', [float(x) for x in s.strip().split("\t")[1:]]).tofile(fOut)
+    fOut.close()
+    f.close()
 
-    for k in dClusters.keys():
-        if len(dClusters[k]) <= 2:
-            dCentroids[k] = dClusters[k][0]
-        else:
-            dAvgDists = {}
-            for x in dClusters[k]:
-                flAvgDist = 0.0
-                for y in dClusters[k]:
-                    flAvgDist += dSimMatrix[x][y]
-                flAvgDist /= float(len(dClusters[k]))
-                dAvgDists[flAvgDist] = x
-            flMin = max(dAvgDists.keys())
-            dCentroids[k] = dAvgDists[flMin]
-
-    return dCentroids
+    return sBinFile
 
 # ---------------------------------------------------------------
 
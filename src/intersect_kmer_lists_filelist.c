@@ -4,8 +4,18 @@ Takes a list of input kmer list files and prints the similarity between the
 first list (assumed to be from reads) and all other lists (assumed to be from a 
 set of reference genomes).
 
+With --top K only the K references with the highest similarity are printed,
+best first. Each reference is then merged with the reads while it is read,
+and reading it stops as soon as it can not get into the top K anymore. After
+j of its L kmers with c of them found and r read kmers left to match, it can
+at best reach (c + min(L - j, r)) / L. The results are the same as without
+--top, passing the likely best references first makes the cut-off work sooner.
+L is taken from the [list].len file next to each list if there is one, see
+klist_length, so references that are cut off are not read to the end.
+
 Author: ulf.schaefer@phe.gov.uk 31Jul2013
 Modified: sam.gallop@nbi.ac.uk 20Nov2018
+Modified: agent@local 19Oct2026
 
 ****************************************************************/
 
@@ -16,69 +26,100 @@ Modified: sam.gallop@nbi.ac.uk 20Nov2018
 #include <glob.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <getopt.h>
+
+#include "kmer_list_io.h"
 
-#define VERSION 0.2
+#define VERSION 0.3
 
 void displayUsage(char*);
-long long countFileLines(FILE*);
+int intersect_top(long long *laList1, long long llLen1, KmerListReader *pReader2, long long llLen2,
+                  int iTop, int iNofTop, long long *llpTopC, long long *llpTopLen, long long *llpC);
 
 //---------------------------------------------------------------
 int main(int argc,  char *argv[])
 {
+ int iTop = 0, iOpt = 0;
+ static struct option oaLongOpts[] = {
+  {"top", required_argument, 0, 't'},
+  {0, 0, 0, 0}
+ };
+ while ((iOpt = getopt_long(argc, argv, "t:", oaLongOpts, NULL)) != -1) {
+  if (iOpt == 't') {
+   iTop = atoi(optarg);
+  } else {
+   displayUsage(argv[0]);
+   exit(1);
+  }
+ }
+ // the lists follow the options
+ argv[optind - 1] = argv[0];
+ argv += optind - 1;
+ argc -= optind - 1;
+
  if (argc < 3 ) {
   displayUsage(argv[0]);
   exit(1);
  }
 
- int k = 0;    
+ int k = 0, t = 0, iNofTop = 0;    
  long long i = 0, j = 0, c = 0;
- long long llLen1 = 0, llLen2 = 0, lines = 0;
+ long long llLen1 = 0, llLen2 = 0;
  float flSim = 0.0, flDist = 0.0;
- FILE *fListFile1; 
- FILE *fListFile2;
+ KmerListReader oReader2;
  long long *laList1, *laList2;
 
- if ((fListFile1 = fopen(argv[1], "r")) == NULL) {
-  fprintf(stderr, "Can't open file: %s\n", argv[1]);
-  exit(1);
- }
- 
- lines = countFileLines(fListFile1);
- //fprintf(stdout, "%s contains %lld lines\n", argv[1], lines);
- 
- if ((laList1 = (long long*)malloc(sizeof(long long) * lines)) == NULL) {
-  fprintf(stderr, "Memory allocation failed\n");
-  exit(2);
- }
- memset(laList1, 0, sizeof(long long) * lines);
- 
- fseek(fListFile1, 0, SEEK_SET);
- while(!feof(fListFile1)) {
-  fscanf(fListFile1, "%lld\n", &laList1[llLen1]);
-  llLen1++;
- }
+ laList1 = klist_load(argv[1], &llLen1);
 
- for (k = 2; k < argc; k++) {                  
-  if ((fListFile2 = fopen(argv[k], "r")) == NULL) {
-   fprintf(stderr, "Can't open file: %s\n", argv[k]);
-   exit(1);
-  }
-  
-  lines = countFileLines(fListFile2);
-  //fprintf(stdout, "%s contains %lld lines\n", argv[k], lines);
-  
-  if ((laList2 = (long long*)malloc(sizeof(long long) * lines)) == NULL) {
+ if (iTop > 0) {
+  // the best K so far, best first
+  long long *llpTopC, *llpTopLen;
+  int *ipTopFile;
+  if ((llpTopC = (long long*)malloc(sizeof(long long) * (iTop+1))) == NULL ||
+      (llpTopLen = (long long*)malloc(sizeof(long long) * (iTop+1))) == NULL ||
+      (ipTopFile = (int*)malloc(sizeof(int) * (iTop+1))) == NULL) {
    fprintf(stderr, "Memory allocation failed\n");
    exit(2);
   }
-  memset(laList2, 0, sizeof(long long) * lines);
 
-  llLen2 = 0;
-  fseek(fListFile2, 0, SEEK_SET);
-  while(!feof(fListFile2)) {
-   fscanf(fListFile2, "%lld\n", &laList2[llLen2]);
-   llLen2++;
-  }        
+  for (k = 2; k < argc; k++) {
+   // the length is needed up front for the bound. with a .len file next to
+   // the list, lists that drop out early are never read to the end.
+   llLen2 = klist_length(argv[k]);
+   klist_open(&oReader2, argv[k]);
+
+   // empty lists have no similarity
+   if (llLen2 > 0 && intersect_top(laList1, llLen1, &oReader2, llLen2, iTop, iNofTop, llpTopC, llpTopLen, &c) != 0) {
+    // insert after all entries that are at least as good, the first file wins ties
+    for (t = iNofTop; t > 0 && c * llpTopLen[t-1] > llpTopC[t-1] * llLen2; t--) {
+     llpTopC[t] = llpTopC[t-1];
+     llpTopLen[t] = llpTopLen[t-1];
+     ipTopFile[t] = ipTopFile[t-1];
+    }
+    llpTopC[t] = c;
+    llpTopLen[t] = llLen2;
+    ipTopFile[t] = k;
+    if (iNofTop < iTop)
+     iNofTop++;
+   }
+   klist_close(&oReader2);
+  }
+
+  for (t = 0; t < iNofTop; t++) {
+   flSim = (float)llpTopC[t] / ( (float)llpTopLen[t] / 100.0);
+   flDist = 100.0 - flSim;
+   fprintf(stdout, "%f\t%f\t%s\n", flSim, flDist, argv[ipTopFile[t]]);
+  }
+
+  free(llpTopC);
+  free(llpTopLen);
+  free(ipTopFile);
+  free(laList1);
+  return 0;
+ }
+
+ for (k = 2; k < argc; k++) {                  
+  laList2 = klist_load(argv[k], &llLen2);
 
   i = 0, j = 0, c = 0;
   while (i < llLen1 && j < llLen2) {
@@ -100,15 +141,49 @@ int main(int argc,  char *argv[])
 
   flDist = 100.0 - flSim;
   fprintf(stdout, "%f\t%f\t%s\n", flSim, flDist, argv[k]);
-  fclose(fListFile2);
   free(laList2);
  }
 
- fclose(fListFile1);
  free(laList1);
  return 0;
 }
 
+//---------------------------------------------------------------
+// streams a reference list of llLen2 kmers from the file and counts the ones
+// in the read list. returns 0 as soon as it is certain the reference will not
+// get into the top iTop, else 1 with the count in *llpC.
+int intersect_top(long long *laList1, long long llLen1, KmerListReader *pReader2, long long llLen2,
+                  int iTop, int iNofTop, long long *llpTopC, long long *llpTopLen, long long *llpC)
+{
+ long long i = 0, j = 0, c = 0, llKmer = 0, llRest = 0;
+ // bound to beat is llpTopC[iTop-1] / llpTopLen[iTop-1], compared multiplied out
+ int iFull = (iNofTop >= iTop);
+
+ while (j < llLen2 && klist_next(pReader2, &llKmer) != 0) {
+  j++;
+  while (i < llLen1 && laList1[i] < llKmer)
+   i++;
+  if (i < llLen1 && laList1[i] == llKmer) {
+   i++; c++;
+  }
+
+  if (iFull) {
+   llRest = llLen2 - j;
+   if (llLen1 - i < llRest)
+    llRest = llLen1 - i;
+   if ((c + llRest) * llpTopLen[iTop-1] < llpTopC[iTop-1] * llLen2)
+    return 0;
+  }
+
+  // no more read kmers to match, the rest of the list does not change c
+  if (i >= llLen1)
+   break;
+ }
+
+ *llpC = c;
+ return 1;
+}
+
 //---------------------------------------------------------------
 void displayUsage(char* parent)
 {
@@ -116,30 +191,12 @@ void displayUsage(char* parent)
  char *path = strdup(parent);
  app = basename(path);
  fprintf(stdout, "\n%s v%0.1f\n", app, VERSION);
- fprintf(stdout, "Usage: %s [readkmerlist] [refkmerlist_1] [refkmerlist_2] ... [refkmerlist_n]\n", app);
+ fprintf(stdout, "Usage: %s [--top K] [readkmerlist] [refkmerlist_1] [refkmerlist_2] ... [refkmerlist_n]\n", app);
  fprintf(stdout, " [refkmerlist]       - File containing a list of sorted kmers. This is generate off of a fastq\n");
  fprintf(stdout, "                     - file (reads) and used to investigate similarities against the set of\n");
  fprintf(stdout, "                     - reference genomes\n");
  fprintf(stdout, " [refkmerlist_1,2,n] - List of files containing sorted kmers. These files are the reference\n");
  fprintf(stdout, "                     - genomes used to compare against the first kmer list (reads)\n");
-}
-
-//---------------------------------------------------------------
-long long countFileLines(FILE *fp)
-{
- char ch;
- long long linecount = 0;
- 
- // check if file is open
- if (fp) {
-  // read character from file until EOF
-  while ((ch = getc(fp)) != EOF) {
-   if (ch == '\n')
-    ++linecount;
-  }
- } else {
-  fprintf(stderr, "File is not open\n");
- }
- 
- return linecount;
+ fprintf(stdout, " --top K             - Only print the K most similar references, best first. References that\n");
+ fprintf(stdout, "                     - can not get into the top K anymore are not read to the end\n");
 }
@@ -0,0 +1,508 @@
+/* ***************************************************************
+
+Average linkage (UPGMA) clustering of a group of reference genomes and
+selection of one centroid per cluster, for one or more numbers of
+clusters.
+
+Reads the binary similarity matrix written by setup_refs.py
+(int n followed by n*n doubles, row by row, native byte order).
+Distances are 1-similarity. Only the upper triangle is kept in memory.
+The tree is built with the nearest-neighbour-chain algorithm in O(n^2)
+time and cut into at most [nclusters] clusters. Results are identical to
+scipy's linkage(method='average') followed by
+fcluster(criterion='maxclust'), including the numbering of the clusters.
+
+The centroid of a cluster with one or two members is its first member,
+otherwise the member with the highest average similarity to all members
+(the last one on ties).
+
+Prints one line per genome and number of clusters:
+
+[nclusters]	[genome index]	[cluster number]	[1 if centroid, else 0]
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libgen.h>
+
+typedef struct
+{
+    int iLeft, iRight;      // cluster ids, < n for genomes
+    double flDist;
+    int iOrder;             // position in the merge order of nn_chain
+} Merge;
+
+void displayUsage(char*);
+double *load_condensed(const char *sFile, int *ipN);
+long long condensed_index(int n, int i, int j);
+double similarity(const double *flpSim, int n, int i, int j);
+void nn_chain(double *flpD, int n, Merge *pZ);
+void label_merges(Merge *pZ, int n);
+void cut_tree(const Merge *pZ, int n, int iMaxClusters, int *ipCluster);
+int compare_merges(const void * a, const void * b);
+int compare (const void * a, const void * b);
+
+// --------------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        displayUsage(argv[0]);
+        exit(1);
+    }
+
+    int n = 0, i = 0, j = 0, k = 0, c = 0;
+    double *flpSim = load_condensed(argv[1], &n);
+
+    // nn_chain overwrites the distances, the similarities are kept as they
+    // are for the centroids
+    long long llNofPairs = (long long)n*(n-1)/2, p = 0;
+    double *flpD;
+    Merge *pZ;
+    int *ipCluster, *ipCentroid;
+    double *flpBest;
+    if ((flpD=(double*)malloc(sizeof(double)*(llNofPairs+1))) == NULL ||
+        (pZ=(Merge*)malloc(sizeof(Merge)*n)) == NULL ||
+        (ipCluster=(int*)malloc(sizeof(int)*n)) == NULL ||
+        (ipCentroid=(int*)malloc(sizeof(int)*(n+1))) == NULL ||
+        (flpBest=(double*)malloc(sizeof(double)*(n+1))) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    for (p = 0; p < llNofPairs; p++)
+        flpD[p] = 1.0 - flpSim[p];
+
+    nn_chain(flpD, n, pZ);
+    label_merges(pZ, n);
+    free(flpD);
+
+    int *ipSizes;
+    if ((ipSizes=(int*)malloc(sizeof(int)*(n+1))) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    double flAvg = 0.0;
+    for (k = 2; k < argc; k++)
+    {
+        int iMaxClusters = atoi(argv[k]);
+        if (iMaxClusters < 1)
+        {
+            fprintf(stderr, "number of clusters must be positive\n");
+            exit(1);
+        }
+        cut_tree(pZ, n, iMaxClusters, ipCluster);
+
+        memset(ipSizes, 0, sizeof(int)*(n+1));
+        for (i = 0; i < n; i++)
+            ipSizes[ipCluster[i]]++;
+
+        // medoid: highest average similarity to the members of its cluster
+        for (c = 0; c <= n; c++)
+            ipCentroid[c] = -1;
+        for (i = 0; i < n; i++)
+        {
+            c = ipCluster[i];
+            if (ipSizes[c] <= 2)
+            {
+                if (ipCentroid[c] < 0)
+                    ipCentroid[c] = i;
+                continue;
+            }
+            flAvg = 0.0;
+            for (j = 0; j < n; j++)
+            {
+                if (ipCluster[j] == c)
+                    flAvg += similarity(flpSim, n, i, j);
+            }
+            flAvg /= (double)ipSizes[c];
+            if (ipCentroid[c] < 0 || flAvg >= flpBest[c])
+            {
+                ipCentroid[c] = i;
+                flpBest[c] = flAvg;
+            }
+        }
+
+        for (i = 0; i < n; i++)
+            printf("%d\t%d\t%d\t%d\n", iMaxClusters, i, ipCluster[i], (ipCentroid[ipCluster[i]] == i) ? 1 : 0);
+    }
+
+    free(flpSim);
+    free(pZ);
+    free(ipCluster);
+    free(ipCentroid);
+    free(flpBest);
+    free(ipSizes);
+
+    return 0;
+}
+
+//---------------------------------------------------------------
+void displayUsage(char* parent)
+{
+    char *app;
+    char *path = strdup(parent);
+    app = basename(path);
+    fprintf(stdout, "\nUsage: %s [simmat.bin] [nclusters_1] ... [nclusters_n]\n", app);
+    fprintf(stdout, " [simmat.bin]   - Binary similarity matrix written by setup_refs.py\n");
+    fprintf(stdout, " [nclusters]    - Cut the tree into at most this many clusters [e.g. 3 40]\n\n");
+    free(path);
+}
+
+// ----------------------------------------------------------------------------
+
+// reads the matrix one row at a time and keeps the similarities of the upper
+// triangle in the condensed form used by scipy
+double *load_condensed(const char *sFile, int *ipN)
+{
+    FILE *fMatFile;
+    if ((fMatFile = fopen(sFile, "rb")) == NULL)
+    {
+        fprintf(stderr, "Can't open file: %s\n", sFile);
+        exit(1);
+    }
+
+    int n = 0, i = 0, j = 0;
+    if (fread(&n, sizeof(int), 1, fMatFile) != 1 || n < 1)
+    {
+        fprintf(stderr, "Not a similarity matrix: %s\n", sFile);
+        exit(1);
+    }
+
+    double *flpSim, *flpRow;
+    if ((flpSim=(double*)malloc(sizeof(double)*((long long)n*(n-1)/2+1))) == NULL ||
+        (flpRow=(double*)malloc(sizeof(double)*n)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (fread(flpRow, sizeof(double), n, fMatFile) != (size_t)n)
+        {
+            fprintf(stderr, "Truncated similarity matrix: %s\n", sFile);
+            exit(1);
+        }
+        for (j = i+1; j < n; j++)
+            flpSim[condensed_index(n, i, j)] = flpRow[j];
+    }
+    fclose(fMatFile);
+    free(flpRow);
+
+    *ipN = n;
+    return flpSim;
+}
+
+// ----------------------------------------------------------------------------
+
+long long condensed_index(int n, int i, int j)
+{
+    if (i > j)
+    {
+        int t = i; i = j; j = t;
+    }
+    return (long long)n*i - (long long)i*(i+1)/2 + (j - i - 1);
+}
+
+// ----------------------------------------------------------------------------
+
+double similarity(const double *flpSim, int n, int i, int j)
+{
+    if (i == j)
+        return 1.0;
+    return flpSim[condensed_index(n, i, j)];
+}
+
+// ----------------------------------------------------------------------------
+
+// nearest-neighbour-chain algorithm. follows nearest neighbours until two
+// clusters are each other's nearest neighbour and merges them. the merged
+// cluster takes the place of the one with the higher index.
+void nn_chain(double *flpD, int n, Merge *pZ)
+{
+    int *ipSize, *ipChain;
+    if ((ipSize=(int*)malloc(sizeof(int)*n)) == NULL ||
+        (ipChain=(int*)malloc(sizeof(int)*n)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    int i = 0, k = 0, x = 0, y = 0, t = 0, iChainLen = 0, nx = 0, ny = 0, ni = 0;
+    double flMin = 0.0, flDist = 0.0;
+    long long llXI = 0, llYI = 0;
+
+    for (i = 0; i < n; i++)
+        ipSize[i] = 1;
+
+    for (k = 0; k < n-1; k++)
+    {
+        if (iChainLen == 0)
+        {
+            for (i = 0; i < n; i++)
+            {
+                if (ipSize[i] > 0)
+                {
+                    ipChain[0] = i;
+                    iChainLen = 1;
+                    break;
+                }
+            }
+        }
+
+        while (1)
+        {
+            x = ipChain[iChainLen-1];
+            if (iChainLen > 1)
+            {
+                y = ipChain[iChainLen-2];
+                flMin = flpD[condensed_index(n, x, y)];
+            }
+            else
+            {
+                flMin = INFINITY;
+            }
+
+            for (i = 0; i < n; i++)
+            {
+                if (ipSize[i] == 0 || i == x)
+                    continue;
+                flDist = flpD[condensed_index(n, x, i)];
+                if (flDist < flMin)
+                {
+                    flMin = flDist;
+                    y = i;
+                }
+            }
+
+            if (iChainLen > 1 && y == ipChain[iChainLen-2])
+                break;
+
+            ipChain[iChainLen] = y;
+            iChainLen++;
+        }
+
+        iChainLen -= 2;
+
+        if (x > y)
+        {
+            t = x; x = y; y = t;
+        }
+        nx = ipSize[x];
+        ny = ipSize[y];
+        pZ[k].iLeft = x;
+        pZ[k].iRight = y;
+        pZ[k].flDist = flMin;
+        pZ[k].iOrder = k;
+
+        ipSize[x] = 0;
+        ipSize[y] = nx + ny;
+
+        // Lance-Williams update for average linkage
+        for (i = 0; i < n; i++)
+        {
+            ni = ipSize[i];
+            if (ni == 0 || i == y)
+                continue;
+            llXI = condensed_index(n, i, x);
+            llYI = condensed_index(n, i, y);
+            flpD[llYI] = (nx * flpD[llXI] + ny * flpD[llYI]) / (nx + ny);
+        }
+    }
+
+    free(ipSize);
+    free(ipChain);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// sorts the merges by distance (stable) and renames the clusters so that
+// merge k creates cluster n+k, the smaller id of both children on the left
+void label_merges(Merge *pZ, int n)
+{
+    int i = 0, x = 0, y = 0, iNext = n;
+    int *ipParent;
+    if ((ipParent=(int*)malloc(sizeof(int)*(2*n))) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    for (i = 0; i < 2*n; i++)
+        ipParent[i] = i;
+
+    qsort(pZ, n-1, sizeof(Merge), compare_merges);
+
+    for (i = 0; i < n-1; i++)
+    {
+        x = pZ[i].iLeft;
+        y = pZ[i].iRight;
+        while (ipParent[x] != x)
+            x = ipParent[x];
+        while (ipParent[y] != y)
+            y = ipParent[y];
+        pZ[i].iLeft = (x < y) ? x : y;
+        pZ[i].iRight = (x < y) ? y : x;
+        ipParent[x] = iNext;
+        ipParent[y] = iNext;
+        iNext++;
+    }
+
+    free(ipParent);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// cuts the tree at the lowest height that gives at most iMaxClusters clusters
+// and numbers the clusters in the order scipy's fcluster does
+void cut_tree(const Merge *pZ, int n, int iMaxClusters, int *ipCluster)
+{
+    int i = 0, k = 0, iRoot = 0, iNofClusters = 0, iLeader = -1;
+    int iL = 0, iR = 0;
+    double flCutoff = -INFINITY;
+
+    double *flpMaxDist, *flpSorted;
+    int *ipStack;
+    char *cpVisited;
+    if ((flpMaxDist=(double*)malloc(sizeof(double)*n)) == NULL ||
+        (flpSorted=(double*)malloc(sizeof(double)*n)) == NULL ||
+        (ipStack=(int*)malloc(sizeof(int)*n)) == NULL ||
+        (cpVisited=(char*)malloc(sizeof(char)*2*n)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    for (i = 0; i < n-1; i++)
+    {
+        flpMaxDist[i] = pZ[i].flDist;
+        if (pZ[i].iLeft >= n && flpMaxDist[pZ[i].iLeft-n] > flpMaxDist[i])
+            flpMaxDist[i] = flpMaxDist[pZ[i].iLeft-n];
+        if (pZ[i].iRight >= n && flpMaxDist[pZ[i].iRight-n] > flpMaxDist[i])
+            flpMaxDist[i] = flpMaxDist[pZ[i].iRight-n];
+    }
+
+    // every merge at or below the cutoff is done, n minus those are left.
+    // take the lowest cutoff that leaves at most iMaxClusters.
+    if (iMaxClusters < n)
+    {
+        memcpy(flpSorted, flpMaxDist, sizeof(double)*(n-1));
+        qsort(flpSorted, n-1, sizeof(double), compare);
+        for (i = 0; i < n-1; i++)
+        {
+            if (i+1 < n-1 && flpSorted[i+1] == flpSorted[i])
+                continue;
+            if (n - (i+1) <= iMaxClusters)
+            {
+                flCutoff = flpSorted[i];
+                break;
+            }
+        }
+    }
+
+    // no cut needed, scipy numbers the genomes in order then
+    for (i = 0; i < n; i++)
+        ipCluster[i] = (iMaxClusters >= n) ? i+1 : 1;
+    if (n < 2 || iMaxClusters >= n)
+    {
+        free(flpMaxDist);
+        free(flpSorted);
+        free(ipStack);
+        free(cpVisited);
+        return;
+    }
+
+    // depth first from the root, internal children before leaves
+    memset(cpVisited, 0, sizeof(char)*2*n);
+    iNofClusters = 0;
+    k = 0;
+    ipStack[0] = 2*n-2;
+    while (k >= 0)
+    {
+        iRoot = ipStack[k] - n;
+        iL = pZ[iRoot].iLeft;
+        iR = pZ[iRoot].iRight;
+
+        if (iLeader == -1 && flpMaxDist[iRoot] <= flCutoff)
+        {
+            iLeader = iRoot;
+            iNofClusters++;
+        }
+
+        if (iL >= n && cpVisited[iL] == 0)
+        {
+            cpVisited[iL] = 1;
+            k++;
+            ipStack[k] = iL;
+            continue;
+        }
+        if (iR >= n && cpVisited[iR] == 0)
+        {
+            cpVisited[iR] = 1;
+            k++;
+            ipStack[k] = iR;
+            continue;
+        }
+
+        if (iL < n)
+        {
+            if (iLeader == -1)
+                iNofClusters++;
+            ipCluster[iL] = iNofClusters;
+        }
+        if (iR < n)
+        {
+            if (iLeader == -1)
+                iNofClusters++;
+            ipCluster[iR] = iNofClusters;
+        }
+
+        if (iLeader == iRoot)
+            iLeader = -1;
+        k--;
+    }
+
+    free(flpMaxDist);
+    free(flpSorted);
+    free(ipStack);
+    free(cpVisited);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// helper function for the stdlib qsort, by distance then original order
+int compare_merges(const void * a, const void * b)
+{
+    const Merge *pA = (const Merge*)a;
+    const Merge *pB = (const Merge*)b;
+    if (pA->flDist < pB->flDist) return -1;
+    if (pA->flDist > pB->flDist) return 1;
+    return pA->iOrder - pB->iOrder;
+}
+
+// ----------------------------------------------------------------------------
+
+// helper function for the stdlib qsort
+int compare (const void * a, const void * b)
+{
+  if ( *(double*)a <  *(double*)b ) return -1;
+  if ( *(double*)a >  *(double*)b ) return 1;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// eof
@@ -0,0 +1,25 @@
+/* ***************************************************************
+
+Hash of a kmer, shared by the programs that need one (the Bloom tree
+index and the MinHash sketches).
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#ifndef KMER_HASH_H
+#define KMER_HASH_H
+
+// the finaliser of splitmix64 spreads the base 4 kmer values uniformly
+// over 64 bits
+static inline unsigned long long kmer_hash(long long llKmer)
+{
+    unsigned long long x = (unsigned long long)llKmer;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+#endif
+
+// eof
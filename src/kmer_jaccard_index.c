@@ -3,7 +3,15 @@
 Takes 2 input files (numerically sorted lists of numbers)
 and the Jaccard index.
 
+With -p the pairs of files are read from stdin instead, one pair per
+line separated by a tab, and one line in the same format is printed per
+pair. The first files of the pairs are loaded once, as many at a time
+as fit into MAXBATCHKMERS kmers. Every second file is then read once
+per batch and compared against all loaded files it is paired with, so
+no list is read once per pair.
+
 Author: ulf.schaefer@phe.gov.uk 26Jul2013
+Modified: agent@local 19Oct2026
 
 *************************************************************** */
 
@@ -12,8 +20,24 @@ Author: ulf.schaefer@phe.gov.uk 26Jul2013
 #include <stdlib.h>
 #include <math.h>
 #include <glob.h>
+#include <time.h>
+
+#include "kmer_list_io.h"
 
-#define INILISTLEN 20000000
+#define MAXBATCHKMERS 250000000LL  // 2GB of loaded lists
+
+typedef struct
+{
+    int iFirst, iSecond;        // indices into the sorted file names
+    int iOrder;                 // line of the pair in the input
+    long double flJacc;
+} JaccPair;
+
+int jaccard_pairs(void);
+long double jaccard(const long long *laList1, long long llLen1, const long long *laList2, long long llLen2);
+int file_index(char **sapNames, int iNofNames, const char *sName);
+int compare_names(const void * a, const void * b);
+int compare_pairs(const void * a, const void * b);
 
 // --------------------------------------------------------------------------------------------------------
 
@@ -22,90 +46,299 @@ int main(int argv, const char **args)
     time_t start;
     start = time(NULL);
 
+    if (argv == 2 && strcmp(args[1], "-p") == 0)
+        return jaccard_pairs();
+
     if (argv != 3)
     {
-        printf("\nUsage: intersect_kmer_lists [readkmerlist1] [refkmerlist2]\n\n");
+        printf("\nUsage: kmer_jaccard_index [kmerlist1] [kmerlist2]\n");
+        printf("       kmer_jaccard_index -p < [pairs of kmer lists]\n\n");
         exit(1);
     }
 
-    FILE *fListFile1;
-    FILE *fListFile2;
+    long long llLen1=0, llLen2=0;
+    long long *laList1 = klist_load(args[1], &llLen1);
+    long long *laList2 = klist_load(args[2], &llLen2);
+
+    printf("%Lf\t%s\t%s\n", jaccard(laList1, llLen1, laList2, llLen2), args[1], args[2]);
+
+    free(laList1);
+    free(laList2);
+
+    // printf("Total processing time: %ld secs\n", time(NULL)-start);
 
-    if ((fListFile1 = fopen(args[1], "r")) == NULL)
+    return 0;
+}
+
+// ------------------------------------------------------------------
+
+long double jaccard(const long long *laList1, long long llLen1, const long long *laList2, long long llLen2)
+{
+    long long i=0, j=0, c=0, u=0;
+    while (i<llLen1 && j<llLen2)
     {
-        fprintf(stderr, "Can't open file: %s\n\n", args[1]);
-        exit(1);
+        u++;
+        if (laList1[i] == laList2[j])
+        {
+            i++; j++; c++; continue;
+        }
+        if (laList1[i] > laList2[j])
+        {
+            j++;
+        }
+        else
+        {
+            i++;
+        }
     }
-    
-    if ((fListFile2 = fopen(args[2], "r")) == NULL)
+
+    u += (llLen1-i);
+    u += (llLen2-j);
+
+    return (u > 0) ? (long double)c / (long double)u : 0.0;
+}
+
+// ------------------------------------------------------------------
+
+int jaccard_pairs(void)
+{
+    char *sLine = 0, *sTab = 0;
+    size_t nLineAvail = 0;
+    long lLineLen = 0;
+    char **sapFirst = 0, **sapSecond = 0, **sapNames = 0;
+    int iNofPairs = 0, iPairsAvail = 0, iNofNames = 0, i = 0, j = 0, p = 0;
+
+    // read the pairs
+    while ((lLineLen = getline(&sLine, &nLineAvail, stdin)) >= 0)
     {
-        fprintf(stderr, "Can't open file: %s\n\n", args[2]);
-        exit(1);
+        while (lLineLen > 0 && (sLine[lLineLen-1] == '\n' || sLine[lLineLen-1] == '\r'))
+            lLineLen--;
+        sLine[lLineLen] = '\0';
+        if ((sTab = strchr(sLine, '\t')) == NULL)
+            continue;
+        *sTab = '\0';
+
+        if (iNofPairs >= iPairsAvail)
+        {
+            iPairsAvail = (iPairsAvail > 0) ? iPairsAvail * 2 : 1024;
+            if ((sapFirst=(char**)realloc(sapFirst, sizeof(char*)*iPairsAvail)) == NULL ||
+                (sapSecond=(char**)realloc(sapSecond, sizeof(char*)*iPairsAvail)) == NULL)
+            {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(2);
+            }
+        }
+        if ((sapFirst[iNofPairs]=strdup(sLine)) == NULL || (sapSecond[iNofPairs]=strdup(sTab+1)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(2);
+        }
+        iNofPairs++;
     }
+    free(sLine);
 
-    long long *laList1;
-    long long *laList2;
-    if ((laList1=(long long*)malloc(sizeof(long long)*INILISTLEN)) == NULL)
+    // number the distinct files
+    if ((sapNames=(char**)malloc(sizeof(char*)*(2*iNofPairs+1))) == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
         exit(2);
     }
-    if ((laList2=(long long*)malloc(sizeof(long long)*INILISTLEN)) == NULL)
+    for (p = 0; p < iNofPairs; p++)
+    {
+        sapNames[2*p] = sapFirst[p];
+        sapNames[2*p+1] = sapSecond[p];
+    }
+    qsort(sapNames, 2*iNofPairs, sizeof(char*), compare_names);
+    for (i = 0; i < 2*iNofPairs; i++)
+    {
+        if (iNofNames == 0 || strcmp(sapNames[i], sapNames[iNofNames-1]) != 0)
+            sapNames[iNofNames++] = sapNames[i];
+    }
+
+    JaccPair *pPairs;
+    long long **llpLists, *llpLens;
+    int *ipInBatch, *ipIsFirst;
+    if ((pPairs=(JaccPair*)malloc(sizeof(JaccPair)*(iNofPairs+1))) == NULL ||
+        (llpLists=(long long**)malloc(sizeof(long long*)*(iNofNames+1))) == NULL ||
+        (llpLens=(long long*)malloc(sizeof(long long)*(iNofNames+1))) == NULL ||
+        (ipInBatch=(int*)malloc(sizeof(int)*(iNofNames+1))) == NULL ||
+        (ipIsFirst=(int*)malloc(sizeof(int)*(iNofNames+1))) == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
         exit(2);
     }
-    memset(laList1, 0, sizeof(long long)*INILISTLEN);
-    memset(laList2, 0, sizeof(long long)*INILISTLEN);
+    for (i = 0; i < iNofNames; i++)
+    {
+        llpLists[i] = 0;
+        ipInBatch[i] = 0;
+        ipIsFirst[i] = 0;
+    }
+    for (p = 0; p < iNofPairs; p++)
+    {
+        pPairs[p].iFirst = file_index(sapNames, iNofNames, sapFirst[p]);
+        pPairs[p].iSecond = file_index(sapNames, iNofNames, sapSecond[p]);
+        pPairs[p].iOrder = p;
+        pPairs[p].flJacc = 0.0;
+        ipIsFirst[pPairs[p].iFirst] = 1;
+    }
 
-    long long llLen1=0, llLen2=0;
-    while(!feof(fListFile1))
+    // pairs with the same second file next to each other
+    JaccPair *pSorted;
+    if ((pSorted=(JaccPair*)malloc(sizeof(JaccPair)*(iNofPairs+1))) == NULL)
     {
-        fscanf(fListFile1,"%lld\n",&laList1[llLen1]);
-        llLen1++;
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
     }
+    memcpy(pSorted, pPairs, sizeof(JaccPair)*iNofPairs);
+    qsort(pSorted, iNofPairs, sizeof(JaccPair), compare_pairs);
 
-    while(!feof(fListFile2))
+    // cursors into the loaded lists while a second file is read
+    int *ipCursorList;
+    long long *llpCursors, *llpCommon;
+    if ((ipCursorList=(int*)malloc(sizeof(int)*(iNofPairs+1))) == NULL ||
+        (llpCursors=(long long*)malloc(sizeof(long long)*(iNofPairs+1))) == NULL ||
+        (llpCommon=(long long*)malloc(sizeof(long long)*(iNofPairs+1))) == NULL)
     {
-        fscanf(fListFile2,"%lld\n",&laList2[llLen2]);
-        llLen2++;
-    }    
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
 
-    long long i=0, j=0, c=0, u=0;
-    while (i<llLen1 && j<llLen2)
+    int iNext = 0, iBatch = 0, iNofLoaded = 0, iNofCursors = 0, c = 0;
+    long long llBatchKmers = 0, llLen2 = 0, llKmer = 0;
+    KmerListReader oReader;
+    while (1)
     {
-        u++;
-        if (laList1[i] == laList2[j])
+        // load the next batch of first files
+        llBatchKmers = 0;
+        iNofLoaded = 0;
+        iBatch++;
+        for (; iNext < iNofNames && llBatchKmers < MAXBATCHKMERS; iNext++)
         {
-            i++; j++; c++; continue;
+            if (ipIsFirst[iNext] == 0)
+                continue;
+            llpLists[iNext] = klist_load(sapNames[iNext], &llpLens[iNext]);
+            ipInBatch[iNext] = iBatch;
+            llBatchKmers += llpLens[iNext];
+            iNofLoaded++;
         }
-        if (laList1[i] > laList2[j])
+        if (iNofLoaded == 0)
+            break;
+
+        for (p = 0; p < iNofPairs; p = j)
         {
-            j++;
+            for (j = p; j < iNofPairs && pSorted[j].iSecond == pSorted[p].iSecond; j++)
+                ;
+
+            iNofCursors = 0;
+            for (i = p; i < j; i++)
+            {
+                if (ipInBatch[pSorted[i].iFirst] != iBatch)
+                    continue;
+                if (ipInBatch[pSorted[i].iSecond] == iBatch)
+                {
+                    // both are in memory
+                    pSorted[i].flJacc = jaccard(llpLists[pSorted[i].iFirst], llpLens[pSorted[i].iFirst],
+                                                llpLists[pSorted[i].iSecond], llpLens[pSorted[i].iSecond]);
+                    continue;
+                }
+                ipCursorList[iNofCursors] = i;
+                llpCursors[iNofCursors] = 0;
+                llpCommon[iNofCursors] = 0;
+                iNofCursors++;
+            }
+            if (iNofCursors == 0)
+                continue;
+
+            // read the second file once for all loaded files it is paired with
+            llLen2 = 0;
+            klist_open(&oReader, sapNames[pSorted[p].iSecond]);
+            while (klist_next(&oReader, &llKmer) != 0)
+            {
+                llLen2++;
+                for (c = 0; c < iNofCursors; c++)
+                {
+                    const long long *laList1 = llpLists[pSorted[ipCursorList[c]].iFirst];
+                    long long llLen1 = llpLens[pSorted[ipCursorList[c]].iFirst];
+                    while (llpCursors[c] < llLen1 && laList1[llpCursors[c]] < llKmer)
+                        llpCursors[c]++;
+                    if (llpCursors[c] < llLen1 && laList1[llpCursors[c]] == llKmer)
+                    {
+                        llpCommon[c]++;
+                        llpCursors[c]++;
+                    }
+                }
+            }
+            klist_close(&oReader);
+
+            for (c = 0; c < iNofCursors; c++)
+            {
+                long long llLen1 = llpLens[pSorted[ipCursorList[c]].iFirst];
+                long long u = llLen1 + llLen2 - llpCommon[c];
+                pSorted[ipCursorList[c]].flJacc = (u > 0) ? (long double)llpCommon[c] / (long double)u : 0.0;
+            }
         }
-        else
+
+        for (i = 0; i < iNofNames; i++)
         {
-            i++;
+            if (ipInBatch[i] == iBatch)
+            {
+                free(llpLists[i]);
+                llpLists[i] = 0;
+            }
         }
     }
-    
-    u += (llLen1-i);    
-    u += (llLen2-j);    
 
-    long double flJacc=0.0;    
-    flJacc = (long double)c / (long double)u; 
-    
-    printf("%Lf\t%s\t%s\n", flJacc, args[1], args[2]);
+    // print in the order of the input
+    for (i = 0; i < iNofPairs; i++)
+        pPairs[pSorted[i].iOrder].flJacc = pSorted[i].flJacc;
+    for (p = 0; p < iNofPairs; p++)
+        printf("%Lf\t%s\t%s\n", pPairs[p].flJacc, sapFirst[p], sapSecond[p]);
 
-    free(laList1);
-    free(laList2);
-    fclose(fListFile1);
-    fclose(fListFile2);
+    for (p = 0; p < iNofPairs; p++)
+    {
+        free(sapFirst[p]);
+        free(sapSecond[p]);
+    }
+    free(sapFirst);
+    free(sapSecond);
+    free(sapNames);
+    free(pPairs);
+    free(pSorted);
+    free(llpLists);
+    free(llpLens);
+    free(ipInBatch);
+    free(ipIsFirst);
+    free(ipCursorList);
+    free(llpCursors);
+    free(llpCommon);
 
-    // printf("Total processing time: %ld secs\n", time(NULL)-start);
+    return 0;
+}
 
+// ------------------------------------------------------------------
+
+int file_index(char **sapNames, int iNofNames, const char *sName)
+{
+    char **sapFound = (char**)bsearch(&sName, sapNames, iNofNames, sizeof(char*), compare_names);
+    return (int)(sapFound - sapNames);
+}
+
+// ------------------------------------------------------------------
+
+// helper functions for the stdlib qsort
+int compare_names(const void * a, const void * b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int compare_pairs(const void * a, const void * b)
+{
+    const JaccPair *pA = (const JaccPair*)a, *pB = (const JaccPair*)b;
+    if (pA->iSecond != pB->iSecond) return (pA->iSecond < pB->iSecond) ? -1 : 1;
+    if (pA->iFirst != pB->iFirst) return (pA->iFirst < pB->iFirst) ? -1 : 1;
     return 0;
 }
+
 // ------------------------------------------------------------------
 
 // eof
@@ -0,0 +1,384 @@
+/* ***************************************************************
+
+Reading and writing of the text kmer lists, one decimal number per
+line, shared by all programs that use them.
+
+Lists are read in large blocks with fread. The numbers are parsed
+straight from the buffer, 8 digits at a time where there are 8 in a
+row (an 18mer has up to 11 digits), by treating them as one 64 bit
+word. klist_load reads each list only once and sizes its array from the
+file size and the average line length in the first block. Lists are
+written by formatting the numbers into a large buffer that is written
+out with fwrite when full.
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#ifndef KMER_LIST_IO_H
+#define KMER_LIST_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define KLIST_BUFLEN 4194304
+#define KLIST_PAD 32    // longer than any line, see klist_next
+#define KLIST_LENSUFFIX ".len"
+
+typedef struct
+{
+    FILE *fFile;
+    char *sBuf;
+    long long llPos;    // next unparsed byte
+    long long llEnd;    // end of the data in the buffer
+    int iEof;
+} KmerListReader;
+
+typedef struct
+{
+    FILE *fFile;
+    char *sBuf;
+    long long llPos;
+} KmerListWriter;
+
+static const char klist_caDigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// ----------------------------------------------------------------------------
+
+static inline void klist_open(KmerListReader *pReader, const char *sFile)
+{
+    if ((pReader->fFile = fopen(sFile, "r")) == NULL)
+    {
+        fprintf(stderr, "Can't open file: %s\n", sFile);
+        exit(1);
+    }
+    if ((pReader->sBuf = (char*)malloc(KLIST_BUFLEN + KLIST_PAD)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    pReader->llPos = 0;
+    pReader->llEnd = 0;
+    pReader->iEof = 0;
+    memset(pReader->sBuf, 0, KLIST_PAD);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+static inline void klist_close(KmerListReader *pReader)
+{
+    fclose(pReader->fFile);
+    free(pReader->sBuf);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// moves the unparsed rest to the front and fills up the buffer. the bytes
+// after the data are zeroed so the 8 byte loads of the parser stop there.
+static inline void klist_refill(KmerListReader *pReader)
+{
+    long long llRest = pReader->llEnd - pReader->llPos;
+    size_t nRead = 0;
+
+    memmove(pReader->sBuf, pReader->sBuf + pReader->llPos, llRest);
+    pReader->llPos = 0;
+    pReader->llEnd = llRest;
+
+    nRead = fread(pReader->sBuf + llRest, 1, KLIST_BUFLEN - llRest, pReader->fFile);
+    if (nRead < (size_t)(KLIST_BUFLEN - llRest))
+        pReader->iEof = 1;
+    pReader->llEnd += nRead;
+    memset(pReader->sBuf + pReader->llEnd, 0, KLIST_PAD);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// 1 if all 8 bytes of the word are the characters 0 to 9
+static inline int klist_eight_digits(unsigned long long ullWord)
+{
+    return (((ullWord & 0xF0F0F0F0F0F0F0F0ULL) |
+             (((ullWord + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+// ----------------------------------------------------------------------------
+
+// value of 8 digit characters loaded little endian, i.e. the first digit
+// in the lowest byte. pairs, then quadruples of digits are combined with
+// one multiplication each.
+static inline unsigned long long klist_parse_eight(unsigned long long ullWord)
+{
+    ullWord -= 0x3030303030303030ULL;
+    ullWord = (ullWord * 10) + (ullWord >> 8);
+    ullWord = (((ullWord & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+               (((ullWord >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+
+    return ullWord;
+}
+
+// ----------------------------------------------------------------------------
+
+// parses the next number from the list. returns 0 at the end of the list
+// or at anything that is not a number, like fscanf("%lld") would stop.
+static inline int klist_next(KmerListReader *pReader, long long *llpKmer)
+{
+    char *s, *sEnd;
+    unsigned long long ullVal = 0, ullWord = 0;
+    int iNeg = 0;
+
+    while (1)
+    {
+        // a whole line is always in the buffer
+        if (pReader->llEnd - pReader->llPos < KLIST_PAD && pReader->iEof == 0)
+            klist_refill(pReader);
+        s = pReader->sBuf + pReader->llPos;
+        sEnd = pReader->sBuf + pReader->llEnd;
+        while (s < sEnd && (*s == '\n' || *s == '\r' || *s == ' ' || *s == '\t'))
+            s++;
+        pReader->llPos = s - pReader->sBuf;
+        if (sEnd - s >= KLIST_PAD || pReader->iEof != 0)
+            break;
+    }
+
+    if (s < sEnd && *s == '-')
+    {
+        iNeg = 1;
+        s++;
+    }
+    if (s >= sEnd || *s < '0' || *s > '9')
+        return 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&ullWord, s, 8);
+    while (klist_eight_digits(ullWord))
+    {
+        ullVal = ullVal * 100000000ULL + klist_parse_eight(ullWord);
+        s += 8;
+        memcpy(&ullWord, s, 8);
+    }
+#endif
+    while (*s >= '0' && *s <= '9')
+    {
+        ullVal = ullVal * 10 + (*s - '0');
+        s++;
+    }
+
+    pReader->llPos = s - pReader->sBuf;
+    *llpKmer = (iNeg != 0) ? -(long long)ullVal : (long long)ullVal;
+
+    return 1;
+}
+
+// ----------------------------------------------------------------------------
+
+// number of kmers in a list without parsing it, by counting the line ends
+// block-wise. a last line without one is counted as well.
+static inline long long klist_count(const char *sFile)
+{
+    KmerListReader oReader;
+    long long llCount = 0;
+    char *s, *sEnd, cLast = '\n';
+
+    klist_open(&oReader, sFile);
+    while (oReader.iEof == 0)
+    {
+        oReader.llPos = oReader.llEnd;
+        klist_refill(&oReader);
+        sEnd = oReader.sBuf + oReader.llEnd;
+        for (s = oReader.sBuf; (s = memchr(s, '\n', sEnd - s)) != NULL; s++)
+            llCount++;
+        if (oReader.llEnd > 0)
+            cLast = sEnd[-1];
+    }
+    klist_close(&oReader);
+
+    if (cLast != '\n')
+        llCount++;
+
+    return llCount;
+}
+
+// ----------------------------------------------------------------------------
+
+// number of kmers in a list, as klist_load would read them. it is taken
+// from the file [list].len that kmer_refset_process writes next to the
+// list, unless that is older than the list. otherwise the list is parsed.
+static inline long long klist_length(const char *sFile)
+{
+    KmerListReader oReader;
+    struct stat oStat, oLenStat;
+    FILE *fLenFile;
+    char *sLenFile;
+    long long llLen = -1, llKmer = 0;
+
+    if ((sLenFile = (char*)malloc(strlen(sFile) + strlen(KLIST_LENSUFFIX) + 1)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    sprintf(sLenFile, "%s%s", sFile, KLIST_LENSUFFIX);
+    if (stat(sFile, &oStat) == 0 && stat(sLenFile, &oLenStat) == 0 && oLenStat.st_mtime >= oStat.st_mtime &&
+        (fLenFile = fopen(sLenFile, "r")) != NULL)
+    {
+        if (fscanf(fLenFile, "%lld", &llLen) != 1)
+            llLen = -1;
+        fclose(fLenFile);
+    }
+    free(sLenFile);
+    if (llLen >= 0)
+        return llLen;
+
+    llLen = 0;
+    klist_open(&oReader, sFile);
+    while (klist_next(&oReader, &llKmer) != 0)
+        llLen++;
+    klist_close(&oReader);
+
+    return llLen;
+}
+
+// ----------------------------------------------------------------------------
+
+// reads a whole list into a new array and sets *llpLen to its length.
+// the lines of a list are all about as long, so the file size divided by
+// the average line length of the first block is close to the number of
+// kmers. the array grows by half if that was too few and is cut to the
+// real length at the end.
+static inline long long *klist_load(const char *sFile, long long *llpLen)
+{
+    KmerListReader oReader;
+    struct stat oStat;
+    long long *llpList, *llpList2;
+    long long llAvail = 1024, llLen = 0, llKmer = 0, llLines = 0;
+    char *s, *sEnd;
+
+    klist_open(&oReader, sFile);
+    klist_refill(&oReader);
+    sEnd = oReader.sBuf + oReader.llEnd;
+    for (s = oReader.sBuf; (s = memchr(s, '\n', sEnd - s)) != NULL; s++)
+        llLines++;
+    if (oReader.iEof != 0)
+        llAvail = llLines + 1;
+    else if (llLines > 0 && fstat(fileno(oReader.fFile), &oStat) == 0)
+        llAvail = (long long)((double)oStat.st_size / ((double)oReader.llEnd / llLines) * 1.01) + 1024;
+
+    if ((llpList = (long long*)malloc(sizeof(long long) * llAvail)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    while (klist_next(&oReader, &llKmer) != 0)
+    {
+        if (llLen >= llAvail)
+        {
+            if ((llpList2 = (long long*)realloc(llpList, sizeof(long long) * (llAvail + llAvail / 2))) == NULL)
+            {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(2);
+            }
+            llpList = llpList2;
+            llAvail += llAvail / 2;
+        }
+        llpList[llLen] = llKmer;
+        llLen++;
+    }
+    klist_close(&oReader);
+
+    if (llLen < llAvail && (llpList2 = (long long*)realloc(llpList, sizeof(long long) * (llLen > 0 ? llLen : 1))) != NULL)
+        llpList = llpList2;
+
+    *llpLen = llLen;
+    return llpList;
+}
+
+// ----------------------------------------------------------------------------
+
+static inline void klist_writer_init(KmerListWriter *pWriter, FILE *fFile)
+{
+    pWriter->fFile = fFile;
+    pWriter->llPos = 0;
+    if ((pWriter->sBuf = (char*)malloc(KLIST_BUFLEN + KLIST_PAD)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+static inline void klist_flush(KmerListWriter *pWriter)
+{
+    fwrite(pWriter->sBuf, 1, pWriter->llPos, pWriter->fFile);
+    pWriter->llPos = 0;
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// appends one number and a newline. the digits are written from the back,
+// two at a time.
+static inline void klist_write(KmerListWriter *pWriter, long long llKmer)
+{
+    char caTmp[24];
+    char *s = caTmp + sizeof(caTmp);
+    unsigned long long ullVal = (llKmer < 0) ? -(unsigned long long)llKmer : (unsigned long long)llKmer;
+    int iLen = 0;
+
+    if (pWriter->llPos > KLIST_BUFLEN)
+        klist_flush(pWriter);
+
+    *--s = '\n';
+    while (ullVal >= 100)
+    {
+        s -= 2;
+        memcpy(s, klist_caDigitPairs + 2 * (ullVal % 100), 2);
+        ullVal /= 100;
+    }
+    if (ullVal >= 10)
+    {
+        s -= 2;
+        memcpy(s, klist_caDigitPairs + 2 * ullVal, 2);
+    }
+    else
+    {
+        *--s = '0' + ullVal;
+    }
+    if (llKmer < 0)
+        *--s = '-';
+
+    iLen = caTmp + sizeof(caTmp) - s;
+    memcpy(pWriter->sBuf + pWriter->llPos, s, iLen);
+    pWriter->llPos += iLen;
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// writes out what is left, the file itself stays open
+static inline void klist_writer_close(KmerListWriter *pWriter)
+{
+    klist_flush(pWriter);
+    fflush(pWriter->fFile);
+    free(pWriter->sBuf);
+
+    return;
+}
+
+#endif
+
+// eof
@@ -4,14 +4,25 @@ Creates a sorted list of unique kmers in a fastq file. Only considers
 the alphabetically 'smaller' one between the forward and the reverse
 complement of each kmer.
 
-Reads from stdin. Only pipe in actual reads. E.g.:
+Reads from stdin. Either pipe in only the actual reads, e.g.:
 
-cat file.fq | sed -n '2~4p' | kmer reads_process_stdin 18 > outfile.txt
+cat file.fq | sed -n '2~4p' | kmer_reads_process_stdin 18 > outfile.txt
+
+or the complete fastq file with -f, which also makes the base qualities
+(Phred+33) available:
+
+cat file.fq | kmer_reads_process_stdin -f -q 10 -t 20 18 > outfile.txt
+
+-q masks every base with a quality below the given value, kmers are only
+taken from the stretches between masked bases. -t trims bases with a
+quality below the given value off both ends of each read first. -q and -t
+imply -f. Without them the output is the same for both kinds of input.
 
 Memory requirements for large fastq file might be an issue.
 (> 800MB on 4GB RAM is a [soft] limit) 
 
 Author: ulf.schaefer@phe.gov.uk 24Jun2013
+Modified: agent@local 19Oct2026
 
 *************************************************************** */
 
@@ -19,42 +30,60 @@ Author: ulf.schaefer@phe.gov.uk 24Jun2013
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "kmer_list_io.h"
 
-#define INILINELEN 1000
-#define ININOFKMERS 1000000
 #define ININOFREADS 500000
+#define PHREDOFFSET 33
 
-void q_sort(long long *a, long long llL, long long llR);
 void convert_to_numerical(char *sLine, long lLen, int **ipSeq);
-long rmdup(long long *a, long long lLen);
+long long rmdup(long long *a, long long lLen);
 int compare (const void * a, const void * b);
+long mask_read(char *sSeq, long lLen, const char *sQual, long lQualLen, int iMinQual, int iTrimQual);
+long long count_valid_kmers(const char *sSeq, long lLen, int iKmerLen);
+void displayUsage(void);
 
 // --------------------------------------------------------------------------------------------------------
 
-int main(int argv, const char **args)
+int main(int argv, char **args)
 {
-    time_t start;
-    start = time(NULL);
+    int iFastq = 0, iMinQual = 0, iTrimQual = 0, iOpt = 0;
+    while ((iOpt = getopt(argv, args, "fq:t:")) != -1)
+    {
+        switch (iOpt)
+        {
+            case 'f': iFastq = 1; break;
+            case 'q': iMinQual = atoi(optarg); iFastq = 1; break;
+            case 't': iTrimQual = atoi(optarg); iFastq = 1; break;
+            default: displayUsage(); exit(1);
+        }
+    }
 
-    if (argv != 2)
+    if (argv - optind != 1)
     {
-        printf("\nUsage: kmer_reads_process [kmerlen]\n\n");
+        displayUsage();
         exit(1);
     }
 
-    int KMERLEN=atoi(args[1]);
+    int KMERLEN=atoi(args[optind]);
     int KMERLENMINUSONE = KMERLEN-1;
-    long nNofKmers=(long)pow(4.0, KMERLEN);
+    if (KMERLEN < 1 || KMERLEN > 31)
+    {
+        fprintf(stderr, "kmerlen must be between 1 and 31\n");
+        exit(1);
+    }
 
-    char sLine[INILINELEN];
-    memset(sLine, '\0', sizeof(char)*INILINELEN);
+    char *sLine = 0, *sSeq = 0;
+    size_t nLineAvail = 0, nSeqAvail = 0;
+    long lLineLen = 0, lSeqLen = 0, lLineNum = 0;
 
-    long long *llpKmers=0, *llpKmers2=0;
+    long long *llpKmers=0;
 
     long iAvailReadSpace=0, iNofReads=0, i=0;
     long long lTotalKmers=0;
-    
-    int iLineLen=0;
+
     char** aReads;
     char** aReads2=0;
     if ((aReads=(char**)malloc(sizeof(char*)*ININOFREADS)) == NULL)
@@ -64,10 +93,43 @@ int main(int argv, const char **args)
     }           
     memset(aReads, '\0', sizeof(char*)*ININOFREADS);
     iAvailReadSpace = ININOFREADS;
-    while (fgets(sLine, INILINELEN, stdin))
+    while ((lLineLen = getline(&sLine, &nLineAvail, stdin)) >= 0)
     {
-        iLineLen = strlen(sLine)-1;
-        lTotalKmers += (iLineLen - KMERLENMINUSONE);
+        while (lLineLen > 0 && (sLine[lLineLen-1] == '\n' || sLine[lLineLen-1] == '\r'))
+            lLineLen--;
+        sLine[lLineLen] = '\0';
+
+        // in a fastq file keep the sequence line until its quality line has been read
+        if (iFastq != 0)
+        {
+            lLineNum++;
+            if (lLineNum % 4 == 2)
+            {
+                if ((size_t)lLineLen >= nSeqAvail)
+                {
+                    nSeqAvail = lLineLen + 1;
+                    if ((sSeq=(char*)realloc(sSeq, sizeof(char)*nSeqAvail)) == NULL)
+                    {
+                        fprintf(stderr, "Memory allocation failed\n");
+                        exit(2);
+                    }
+                }
+                memcpy(sSeq, sLine, sizeof(char)*(lLineLen+1));
+                lSeqLen = lLineLen;
+            }
+            if (lLineNum % 4 != 0)
+                continue;
+            lSeqLen = mask_read(sSeq, lSeqLen, sLine, lLineLen, iMinQual, iTrimQual);
+        }
+        else
+        {
+            sSeq = sLine;
+            lSeqLen = lLineLen;
+        }
+
+        // only the kmers that will be extracted are counted, a read shorter
+        // than the kmer length does not have any
+        lTotalKmers += count_valid_kmers(sSeq, lSeqLen, KMERLEN);
     
         if ((iNofReads + 1) > iAvailReadSpace)        
         {
@@ -84,26 +146,25 @@ int main(int argv, const char **args)
             iAvailReadSpace *= 2;
         }
         
-        if ((aReads[iNofReads]=(char*)malloc(sizeof(char)*(iLineLen+1))) == NULL)
+        if ((aReads[iNofReads]=(char*)malloc(sizeof(char)*(lSeqLen+1))) == NULL)
         {
             fprintf(stderr, "Memory allocation failed\n");
             exit(2);
         }        
-        memset(aReads[iNofReads], '\0', sizeof(char)*(iLineLen+1));
-        memcpy(aReads[iNofReads], sLine, sizeof(char)*(iLineLen+1));    
+        memcpy(aReads[iNofReads], sSeq, sizeof(char)*lSeqLen);    
+        aReads[iNofReads][lSeqLen] = '\0';
         
         iNofReads++;
     }
+    free(sLine);
+    if (iFastq != 0)
+        free(sSeq);
     
-    // printf("%lld\n", lTotalKmers);
-    // printf("%li\n", sizeof(long long));   
-    
-    if ((llpKmers=(long long*)malloc(sizeof(long long)*lTotalKmers)) == NULL)
+    if ((llpKmers=(long long*)malloc(sizeof(long long)*(lTotalKmers+1))) == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
         exit(2);
     }
-    memset(llpKmers, 0, sizeof(long long)*lTotalKmers);    
     
     long long iaPowFour[KMERLEN];
     long k=0;    
@@ -113,16 +174,25 @@ int main(int argv, const char **args)
     }
     
     long p=0;
-    int j=0, iReadLen=0, x=0, iValid = 1;
+    long j=0, iReadLen=0;
+    int iValid = 1;
     long long q=0, nKmerFWD=0, nKmerRVC=0;
     int *ipSeq;
-    // while (fgets(sLine, INILINELEN, stdin))
     for (i=0; i<iNofReads; i++)
     {
-        iReadLen = strlen(aReads[i])-1;
-        ipSeq=(int*)malloc(sizeof(int)*iReadLen);
-        memset(ipSeq, 0, sizeof(int)*iReadLen);
+        iReadLen = strlen(aReads[i]);
+        if (iReadLen < KMERLEN)
+        {
+            free(aReads[i]);
+            continue;
+        }
+        if ((ipSeq=(int*)malloc(sizeof(int)*iReadLen)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(2);
+        }
         convert_to_numerical(aReads[i], iReadLen, &ipSeq);
+        free(aReads[i]);
 
         for (j=0; j<iReadLen-KMERLENMINUSONE; j++)
         { 
@@ -132,7 +202,7 @@ int main(int argv, const char **args)
             for (p = KMERLENMINUSONE; p >= 0; p--)
             {
                 // check for invalid chars go to next k-mer if found                    
-                if (ipSeq[j+p] == -1) // N
+                if (ipSeq[j+p] == -1) // N or masked base
                 {
                     iValid = 0;
                     break;
@@ -155,14 +225,9 @@ int main(int argv, const char **args)
             }           
         }
         free(ipSeq);
-                   
-        // memset(sLine, '\0', sizeof(char)*INILINELEN);
     }
+    free(aReads);
 
-    // printf("\nProcessing time excluding sort: %ld secs\n", time(NULL)-start);
-
-    // use stdlib qsort instead of own nonsense    
-    // q_sort(llpKmers, 0, q-1);
     qsort (llpKmers, q, sizeof(long long), compare);
         
     long long a=0, b=0;
@@ -170,19 +235,17 @@ int main(int argv, const char **args)
     {
         if(llpKmers[a] == llpKmers[a+1])
         {
-            // printf("%lld\t", llpKmers[a]);
             a++;
             b++;     
         }    
     }    
     
     long long *llpNonUniqKmers=0;
-    if ((llpNonUniqKmers=(long long*)malloc(sizeof(long long)*b)) == NULL)
+    if ((llpNonUniqKmers=(long long*)malloc(sizeof(long long)*(b+1))) == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
         exit(2);
     }
-    memset(llpNonUniqKmers, 0, sizeof(long long)*b);  
     
     b=0;
     for (a=0; a<q-1; a++)
@@ -196,41 +259,48 @@ int main(int argv, const char **args)
     }
     free(llpKmers);
     
-    long lNewSize=0;
+    long long lNewSize=0;
     lNewSize = rmdup(llpNonUniqKmers, b);
 
     // output kmer
-    // printf("\t%lld", llpNonUniqKmers[0]);
+    KmerListWriter oWriter;
+    klist_writer_init(&oWriter, stdout);
     for (a=0; a<lNewSize; a++)
-        printf("%lld\n", llpNonUniqKmers[a]);
-    // printf("\n");
-    
-    // printf("NewSize: %ld\n", lNewSize );  
-        
-    for (i=0; i<iNofReads; i++)
-        free(aReads[i]);    
-    free(aReads);
-    
-    // printf("\nTotal processing time: %ld secs\n", time(NULL)-start);
+        klist_write(&oWriter, llpNonUniqKmers[a]);
+    klist_writer_close(&oWriter);
+    free(llpNonUniqKmers);
         
     return 0;
 }
 
+//---------------------------------------------------------------
+void displayUsage(void)
+{
+    fprintf(stdout, "\nUsage: kmer_reads_process_stdin [-f] [-q minqual] [-t trimqual] [kmerlen]\n");
+    fprintf(stdout, " -f           - stdin is a complete fastq file, not only the reads\n");
+    fprintf(stdout, " -q minqual   - Skip kmers containing a base with a quality below this [e.g. 10]\n");
+    fprintf(stdout, " -t trimqual  - Trim bases with a quality below this off the read ends [e.g. 20]\n");
+    fprintf(stdout, " [kmerlen]    - Length of the kmers [e.g. 18]\n\n");
+}
+
 // ----------------------------------------------------------------------------
 
 // helper function for the stdlib qsort
 int compare (const void * a, const void * b)
 {
   if ( *(long long*)a <  *(long long*)b ) return -1;
-  if ( *(long long*)a == *(long long*)b ) return 0;
   if ( *(long long*)a >  *(long long*)b ) return 1;
+  return 0;
 }
 
 // ----------------------------------------------------------------------------
 
-long rmdup(long long *a, long long lLen)
+long long rmdup(long long *a, long long lLen)
 {
-    long i=1, j=0;
+    long long i=1, j=0;
+
+    if (lLen == 0)
+        return 0;
     
     for (; i < lLen; i++) 
     { 
@@ -243,6 +313,62 @@ long rmdup(long long *a, long long lLen)
 
     return j+1;
 }
+
+// ----------------------------------------------------------------------------
+
+// trims bases with a quality below iTrimQual off both ends of the read and
+// replaces the ones below iMinQual in the rest by N. returns the new length.
+long mask_read(char *sSeq, long lLen, const char *sQual, long lQualLen, int iMinQual, int iTrimQual)
+{
+    long j=0, lStart=0;
+
+    if (lQualLen < lLen)
+        lLen = lQualLen;
+
+    while (lLen > 0 && sQual[lLen-1] - PHREDOFFSET < iTrimQual)
+        lLen--;
+    while (lStart < lLen && sQual[lStart] - PHREDOFFSET < iTrimQual)
+        lStart++;
+
+    for (j = lStart; j < lLen; j++)
+    {
+        if (sQual[j] - PHREDOFFSET < iMinQual)
+            sSeq[j] = 'N';
+    }
+
+    lLen -= lStart;
+    memmove(sSeq, sSeq + lStart, sizeof(char)*lLen);
+    sSeq[lLen] = '\0';
+
+    return lLen;
+}
+
+// ----------------------------------------------------------------------------
+
+// number of kmers in the read that contain only ACGT
+long long count_valid_kmers(const char *sSeq, long lLen, int iKmerLen)
+{
+    long long llCount=0;
+    long j=0, lRun=0;
+
+    for (j = 0; j < lLen; j++)
+    {
+        switch (sSeq[j])
+        {
+            case 'A': case 'a': case 'C': case 'c':
+            case 'G': case 'g': case 'T': case 't':
+                lRun++;
+                if (lRun >= iKmerLen)
+                    llCount++;
+                break;
+            default:
+                lRun = 0;
+                break;
+        }
+    }
+
+    return llCount;
+}
 // --------------------------------------------------------------------------------------------------------
 
 void convert_to_numerical(char *sLine, long lLen, int **ipSeq)
@@ -0,0 +1,494 @@
+/* ***************************************************************
+
+Incremental version of kmer_reads_process_stdin and
+intersect_kmer_lists_filelist for reads that arrive in chunks while
+a sequencing run is still going.
+
+Reads from stdin. Only pipe in actual reads, followed by a line
+starting with '#' after every chunk. E.g.:
+
+(cat chunk1.fq | sed -n '2~4p'; echo '#'; cat chunk2.fq | sed -n '2~4p'; echo '#') \
+    | kmer_reads_watch 18 ref1_kmers.txt ref2_kmers.txt
+
+With -f, -q and -t the complete fastq records are piped in instead and
+the base qualities are used as in kmer_reads_process_stdin. The marker
+then goes where the header of the next record would be:
+
+(cat chunk1.fq; echo '#'; cat chunk2.fq; echo '#') \
+    | kmer_reads_watch -q 10 18 ref1_kmers.txt ref2_kmers.txt
+
+The per-sample state (kmers seen once so far and the solid kmers seen
+at least twice) and the kmer lists of the references are kept in
+memory. After each chunk only the kmers that became solid in that
+chunk are looked up in the references and added to their running
+intersection counts. A table with the similarity of the reads so far
+to each reference is then printed in the format of
+intersect_kmer_lists_filelist, preceded by a line
+
+#chunk	[chunk number]	[number of solid kmers]
+
+and followed by a line '//'. At any point the solid kmers are exactly
+what kmer_reads_process_stdin would report for all reads so far.
+
+More references can be added while running with a line
+
+#add [refkmerlist]
+
+in place of a marker. The list is loaded, compared once against all
+solid kmers so far, its line of the table is printed followed by '//',
+and from then on it is part of every table. This way only the lists
+that are needed have to be held in memory.
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "kmer_list_io.h"
+
+#define ININOFKMERS 1000000
+#define MAXKMERLEN 31
+#define PHREDOFFSET 33
+
+typedef struct
+{
+    long long *llpKmers;
+    long long llLen;
+    long long llAvail;
+} KmerArray;
+
+typedef struct
+{
+    KmerArray oKmers;
+    long long llCommon;     // solid kmers found in the list so far
+    char *sFile;
+} RefList;
+
+void kmer_array_init(KmerArray *pArr, long long llAvail);
+void kmer_array_push(KmerArray *pArr, long long llKmer);
+void add_read_kmers(const char *sLine, long lLen, int iKmerLen, KmerArray *pChunk);
+long mask_read(char *sSeq, long lLen, const char *sQual, long lQualLen, int iMinQual, int iTrimQual);
+void merge_chunk(KmerArray *pChunk, KmerArray *pOnce, KmerArray *pSolid, KmerArray *pNewSolid);
+long long count_in_list(const KmerArray *pNewSolid, const KmerArray *pRef);
+void load_kmer_list(const char *sFile, KmerArray *pArr);
+void add_ref(RefList **ppRefs, int *ipNofRefs, int *ipAvail, const char *sFile, const KmerArray *pSolid);
+void print_ref(const RefList *pRef);
+int compare (const void * a, const void * b);
+
+// --------------------------------------------------------------------------------------------------------
+
+int main(int argv, char **args)
+{
+    int iFastq = 0, iMinQual = 0, iTrimQual = 0, iOpt = 0, iBadOpt = 0;
+    while ((iOpt = getopt(argv, args, "fq:t:")) != -1)
+    {
+        switch (iOpt)
+        {
+            case 'f': iFastq = 1; break;
+            case 'q': iMinQual = atoi(optarg); iFastq = 1; break;
+            case 't': iTrimQual = atoi(optarg); iFastq = 1; break;
+            default: iBadOpt = 1; break;
+        }
+    }
+
+    if (iBadOpt != 0 || argv - optind < 1)
+    {
+        printf("\nUsage: kmer_reads_watch [-f] [-q minqual] [-t trimqual] [kmerlen] [refkmerlist_1] [refkmerlist_2] ... [refkmerlist_n]\n\n");
+        exit(1);
+    }
+    // from here on args[1] is the kmer length as without options
+    args += optind - 1;
+    argv -= optind - 1;
+
+    int KMERLEN=atoi(args[1]);
+    if (KMERLEN < 1 || KMERLEN > MAXKMERLEN)
+    {
+        fprintf(stderr, "kmerlen must be between 1 and %d\n", MAXKMERLEN);
+        exit(1);
+    }
+
+    KmerArray oChunk, oOnce, oSolid, oNewSolid;
+    kmer_array_init(&oChunk, ININOFKMERS);
+    kmer_array_init(&oOnce, ININOFKMERS);
+    kmer_array_init(&oSolid, ININOFKMERS);
+    kmer_array_init(&oNewSolid, ININOFKMERS);
+
+    RefList *pRefs = 0;
+    int iNofRefs = 0, iRefsAvail = 0, r = 0;
+    for (r = 2; r < argv; r++)
+        add_ref(&pRefs, &iNofRefs, &iRefsAvail, args[r], &oSolid);
+
+    char *sLine = 0, *sSeq = 0;
+    size_t nLineAvail = 0, nSeqAvail = 0;
+    long lLineLen = 0, lSeqLen = 0, lLineNum = 0;
+    int iChunk = 0, iPending = 0;
+    while (1)
+    {
+        lLineLen = getline(&sLine, &nLineAvail, stdin);
+
+        // quality lines can start with '#', so in a fastq file only a
+        // line where a record header is due can be a marker
+        if (lLineLen >= 0 && (sLine[0] != '#' || (iFastq != 0 && lLineNum % 4 != 0)))
+        {
+            while (lLineLen > 0 && (sLine[lLineLen-1] == '\n' || sLine[lLineLen-1] == '\r'))
+                lLineLen--;
+            iPending = 1;
+            if (iFastq == 0)
+            {
+                add_read_kmers(sLine, lLineLen, KMERLEN, &oChunk);
+                continue;
+            }
+
+            lLineNum++;
+            if (lLineNum % 4 == 2)
+            {
+                if ((size_t)lLineLen >= nSeqAvail)
+                {
+                    nSeqAvail = lLineLen + 1;
+                    if ((sSeq=(char*)realloc(sSeq, sizeof(char)*nSeqAvail)) == NULL)
+                    {
+                        fprintf(stderr, "Memory allocation failed\n");
+                        exit(2);
+                    }
+                }
+                memcpy(sSeq, sLine, sizeof(char)*lLineLen);
+                lSeqLen = lLineLen;
+            }
+            else if (lLineNum % 4 == 0)
+            {
+                lSeqLen = mask_read(sSeq, lSeqLen, sLine, lLineLen, iMinQual, iTrimQual);
+                add_read_kmers(sSeq, lSeqLen, KMERLEN, &oChunk);
+            }
+            continue;
+        }
+
+        if (lLineLen >= 0 && strncmp(sLine, "#add ", 5) == 0)
+        {
+            while (lLineLen > 5 && (sLine[lLineLen-1] == '\n' || sLine[lLineLen-1] == '\r'))
+                lLineLen--;
+            sLine[lLineLen] = '\0';
+            add_ref(&pRefs, &iNofRefs, &iRefsAvail, sLine + 5, &oSolid);
+            print_ref(&pRefs[iNofRefs-1]);
+            fprintf(stdout, "//\n");
+            fflush(stdout);
+            continue;
+        }
+
+        // end of a chunk, a missing marker after the last one is fine
+        if (lLineLen >= 0 || iPending != 0)
+        {
+            merge_chunk(&oChunk, &oOnce, &oSolid, &oNewSolid);
+            iChunk++;
+
+            fprintf(stdout, "#chunk\t%d\t%lld\n", iChunk, oSolid.llLen);
+            for (r = 0; r < iNofRefs; r++)
+            {
+                pRefs[r].llCommon += count_in_list(&oNewSolid, &pRefs[r].oKmers);
+                print_ref(&pRefs[r]);
+            }
+            fprintf(stdout, "//\n");
+            fflush(stdout);
+
+            oChunk.llLen = 0;
+            iPending = 0;
+            lLineNum = 0;
+        }
+
+        if (lLineLen < 0)
+            break;
+    }
+
+    free(sLine);
+    free(sSeq);
+    free(oChunk.llpKmers);
+    free(oOnce.llpKmers);
+    free(oSolid.llpKmers);
+    free(oNewSolid.llpKmers);
+    for (r = 0; r < iNofRefs; r++)
+    {
+        free(pRefs[r].oKmers.llpKmers);
+        free(pRefs[r].sFile);
+    }
+    free(pRefs);
+
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void kmer_array_init(KmerArray *pArr, long long llAvail)
+{
+    if ((pArr->llpKmers=(long long*)malloc(sizeof(long long)*llAvail)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    pArr->llLen = 0;
+    pArr->llAvail = llAvail;
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+void kmer_array_push(KmerArray *pArr, long long llKmer)
+{
+    long long *llpKmers2 = 0;
+    if (pArr->llLen >= pArr->llAvail)
+    {
+        if ((llpKmers2=(long long*)realloc(pArr->llpKmers, sizeof(long long)*pArr->llAvail*2)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(2);
+        }
+        pArr->llpKmers = llpKmers2;
+        pArr->llAvail *= 2;
+    }
+    pArr->llpKmers[pArr->llLen] = llKmer;
+    pArr->llLen++;
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// appends the smaller of forward and reverse complement of every kmer in
+// the read that contains only ACGT
+void add_read_kmers(const char *sLine, long lLen, int iKmerLen, KmerArray *pChunk)
+{
+    long long llMask = (1LL << (2*iKmerLen)) - 1;
+    int iTopShift = 2*(iKmerLen-1);
+    long long llFWD=0, llRVC=0;
+    long j=0;
+    int iBase=0, iValidLen=0;
+
+    for (j = 0; j < lLen; j++)
+    {
+        switch (sLine[j])
+        {
+            case 'A': case 'a': iBase = 0; break;
+            case 'C': case 'c': iBase = 1; break;
+            case 'G': case 'g': iBase = 2; break;
+            case 'T': case 't': iBase = 3; break;
+            default: iBase = -1; break;
+        }
+        if (iBase < 0)
+        {
+            iValidLen = 0;
+            continue;
+        }
+
+        llFWD = ((llFWD << 2) | iBase) & llMask;
+        llRVC = (llRVC >> 2) | ((long long)(3-iBase) << iTopShift);
+        if (iValidLen < iKmerLen)
+            iValidLen++;
+        if (iValidLen == iKmerLen)
+            kmer_array_push(pChunk, (llFWD <= llRVC) ? llFWD : llRVC);
+    }
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// trims bases with a quality below iTrimQual off both ends of the read and
+// replaces the ones below iMinQual in the rest by N. returns the new length.
+long mask_read(char *sSeq, long lLen, const char *sQual, long lQualLen, int iMinQual, int iTrimQual)
+{
+    long j=0, lStart=0;
+
+    if (lQualLen < lLen)
+        lLen = lQualLen;
+
+    while (lLen > 0 && sQual[lLen-1] - PHREDOFFSET < iTrimQual)
+        lLen--;
+    while (lStart < lLen && sQual[lStart] - PHREDOFFSET < iTrimQual)
+        lStart++;
+
+    for (j = lStart; j < lLen; j++)
+    {
+        if (sQual[j] - PHREDOFFSET < iMinQual)
+            sSeq[j] = 'N';
+    }
+
+    lLen -= lStart;
+    memmove(sSeq, sSeq + lStart, sizeof(char)*lLen);
+
+    return lLen;
+}
+
+// ----------------------------------------------------------------------------
+
+// merges the kmers of a chunk into the sample state. kmers already solid
+// are ignored, kmers seen before or at least twice in the chunk become
+// solid and are returned in pNewSolid, all others are remembered as seen once.
+void merge_chunk(KmerArray *pChunk, KmerArray *pOnce, KmerArray *pSolid, KmerArray *pNewSolid)
+{
+    qsort(pChunk->llpKmers, pChunk->llLen, sizeof(long long), compare);
+
+    KmerArray oNewOnce;
+    kmer_array_init(&oNewOnce, pOnce->llLen + pChunk->llLen + 1);
+    pNewSolid->llLen = 0;
+
+    long long a=0, b=0, o=0, s=0, llKmer=0;
+    for (a = 0; a < pChunk->llLen; a = b)
+    {
+        llKmer = pChunk->llpKmers[a];
+        for (b = a+1; b < pChunk->llLen && pChunk->llpKmers[b] == llKmer; b++)
+            ;
+
+        while (s < pSolid->llLen && pSolid->llpKmers[s] < llKmer)
+            s++;
+        if (s < pSolid->llLen && pSolid->llpKmers[s] == llKmer)
+            continue;
+
+        while (o < pOnce->llLen && pOnce->llpKmers[o] < llKmer)
+        {
+            kmer_array_push(&oNewOnce, pOnce->llpKmers[o]);
+            o++;
+        }
+        if (o < pOnce->llLen && pOnce->llpKmers[o] == llKmer)
+        {
+            o++;
+            kmer_array_push(pNewSolid, llKmer);
+        }
+        else if (b - a >= 2)
+        {
+            kmer_array_push(pNewSolid, llKmer);
+        }
+        else
+        {
+            kmer_array_push(&oNewOnce, llKmer);
+        }
+    }
+    for (; o < pOnce->llLen; o++)
+        kmer_array_push(&oNewOnce, pOnce->llpKmers[o]);
+
+    free(pOnce->llpKmers);
+    *pOnce = oNewOnce;
+
+    // merge the new solid kmers into the solid set, from the back
+    long long llOldLen = pSolid->llLen, i = 0;
+    for (i = 0; i < pNewSolid->llLen; i++)
+        kmer_array_push(pSolid, 0);
+    s = llOldLen - 1;
+    a = pNewSolid->llLen - 1;
+    for (i = pSolid->llLen - 1; a >= 0; i--)
+    {
+        if (s >= 0 && pSolid->llpKmers[s] > pNewSolid->llpKmers[a])
+        {
+            pSolid->llpKmers[i] = pSolid->llpKmers[s];
+            s--;
+        }
+        else
+        {
+            pSolid->llpKmers[i] = pNewSolid->llpKmers[a];
+            a--;
+        }
+    }
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// number of new solid kmers in a reference, or of all solid kmers when a
+// reference is added. both lists are sorted, the new ones are usually much
+// fewer, so each is found by a binary search in the part of the reference
+// after the previous one.
+long long count_in_list(const KmerArray *pNewSolid, const KmerArray *pRef)
+{
+    long long i=0, llLow=0, llHigh=0, llMid=0, c=0;
+
+    for (i = 0; i < pNewSolid->llLen && llLow < pRef->llLen; i++)
+    {
+        llHigh = pRef->llLen;
+        while (llLow < llHigh)
+        {
+            llMid = llLow + (llHigh - llLow)/2;
+            if (pRef->llpKmers[llMid] < pNewSolid->llpKmers[i])
+                llLow = llMid + 1;
+            else
+                llHigh = llMid;
+        }
+        if (llLow < pRef->llLen && pRef->llpKmers[llLow] == pNewSolid->llpKmers[i])
+        {
+            c++;
+            llLow++;
+        }
+    }
+
+    return c;
+}
+
+// ----------------------------------------------------------------------------
+
+void load_kmer_list(const char *sFile, KmerArray *pArr)
+{
+    pArr->llpKmers = klist_load(sFile, &pArr->llLen);
+    pArr->llAvail = (pArr->llLen > 0) ? pArr->llLen : 1;
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// loads another reference list and counts the solid kmers so far in it
+void add_ref(RefList **ppRefs, int *ipNofRefs, int *ipAvail, const char *sFile, const KmerArray *pSolid)
+{
+    RefList *pRefs2 = 0, *pRef = 0;
+    if (*ipNofRefs >= *ipAvail)
+    {
+        *ipAvail = (*ipAvail > 0) ? *ipAvail * 2 : 64;
+        if ((pRefs2=(RefList*)realloc(*ppRefs, sizeof(RefList)*(*ipAvail))) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(2);
+        }
+        *ppRefs = pRefs2;
+    }
+
+    pRef = &(*ppRefs)[*ipNofRefs];
+    if ((pRef->sFile=strdup(sFile)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    load_kmer_list(sFile, &pRef->oKmers);
+    pRef->llCommon = count_in_list(pSolid, &pRef->oKmers);
+    (*ipNofRefs)++;
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+void print_ref(const RefList *pRef)
+{
+    float flSim = 0.0, flDist = 0.0;
+
+    flSim = (pRef->oKmers.llLen > 0) ? (float)pRef->llCommon / ( (float)pRef->oKmers.llLen / 100.0) : 0.0;
+    flDist = 100.0 - flSim;
+    fprintf(stdout, "%f\t%f\t%s\n", flSim, flDist, pRef->sFile);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// helper function for the stdlib qsort
+int compare (const void * a, const void * b)
+{
+  if ( *(long long*)a <  *(long long*)b ) return -1;
+  if ( *(long long*)a >  *(long long*)b ) return 1;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// eof
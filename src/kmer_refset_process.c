@@ -1,11 +1,21 @@
 /* ***************************************************************
 
-Creates a sorted list of unique 18mers in a fasta file. All sequences 
-in the file are considered to be one big contiguous sequence. Only counts
+Creates a sorted list of unique kmers in a fasta file. Only counts
 the alphabetically 'smaller' one between the forward and the reverse
-complement of each 18mer.
+complement of each kmer.
+
+The sequence is streamed into a 2-bit packed representation (4 bases
+per byte) with a side list of N runs and contig boundaries, so memory
+use stays at about a quarter byte per base for the sequence itself.
+Every sequence ('>' record) in the file is treated as a separate
+contig. Kmers spanning the join between two contigs or containing
+any non-ACGT character are not counted.
+
+If a third file is given, the number of kmers in the list is written
+to it. By convention this is [kmerlist].len, see klist_length.
 
 Author: ulf.schaefer@phe.gov.uk 26Jun2013
+Modified: agent@local 19Oct2026
 
 *************************************************************** */
 
@@ -14,29 +24,56 @@ Author: ulf.schaefer@phe.gov.uk 26Jun2013
 #include <stdlib.h>
 #include <math.h>
 
-#define INILINELEN 1000
-#define INISEQLEN 10000
+#include "kmer_list_io.h"
 
-void q_sort(long long *a, long long llL, long long llR);
-long rmdup(long long *a, long lLen);
-long long median3(long long a, long long b, long long c);
-int compare (const void * a, const void * b); 
+#define INIBUFLEN 1048576
+#define INISEQLEN 1048576
+#define ININOFRUNS 1024
+#define MAXKMERLEN 31
+
+// 2-bit packed sequence with side lists of N runs and contig starts
+typedef struct
+{
+    unsigned char *ucpBases;    // 4 bases per byte, A=0 C=1 G=2 T=3
+    long long llLen;            // number of bases stored
+    long long llAvail;          // number of bases that fit into ucpBases
+
+    long long *llpNStart;       // first position of each N run
+    long long *llpNEnd;         // one past the last position of each N run
+    long long llNofNRuns;
+    long long llAvailNRuns;
+
+    long long *llpContigStart;  // first position of each contig
+    long long llNofContigs;
+    long long llAvailContigs;
+} PackedSeq;
+
+void packed_seq_init(PackedSeq *pSeq);
+void packed_seq_free(PackedSeq *pSeq);
+void packed_seq_read_fasta(FILE *fFastaFile, PackedSeq *pSeq);
+void packed_seq_append_base(PackedSeq *pSeq, int iBase);
+void packed_seq_add_contig(PackedSeq *pSeq);
+int packed_seq_get_base(const PackedSeq *pSeq, long long llPos);
+void *grow_array(void *vpArray, long long llNewLen, size_t nElemSize);
+long long extract_kmers(const PackedSeq *pSeq, int iKmerLen, long long *llpKmers);
+long long rmdup(long long *a, long long llLen);
+int compare (const void * a, const void * b);
 // --------------------------------------------------------------------------------------------------------
 
 int main(int argv, const char **args)
 {
-    time_t start;
-    start = time(NULL);
-
-    if (argv != 3)
+    if (argv != 3 && argv != 4)
     {
-        printf("\nUsage: kmer_refset_process [kmerlen] [file.fa]\n\n");
+        printf("\nUsage: kmer_refset_process [kmerlen] [file.fa] [lengthfile]\n\n");
         exit(1);
     }
 
     int KMERLEN=atoi(args[1]);
-    int KMERLENMINUSONE = KMERLEN-1;
-    long long nNofKmers=(long long)pow(4.0, KMERLEN);
+    if (KMERLEN < 1 || KMERLEN > MAXKMERLEN)
+    {
+        fprintf(stderr, "kmerlen must be between 1 and %d\n", MAXKMERLEN);
+        exit(1);
+    }
 
     FILE *fFastaFile;
 
@@ -46,258 +83,326 @@ int main(int argv, const char **args)
         exit(1);
     }
 
-    char sLine[INILINELEN];
-    memset(sLine, '\0', sizeof(char)*INILINELEN);
+    PackedSeq oSeq;
+    packed_seq_init(&oSeq);
+    packed_seq_read_fasta(fFastaFile, &oSeq);
+    fclose(fFastaFile);
 
-    char *cpSeq=0, *cpSeq2=0;
-    int iAvailLen = INISEQLEN;    
-    if ((cpSeq=(char*)malloc(sizeof(char)*INISEQLEN)) == NULL)
+    // there can never be more kmers than bases in the file
+    long long llNofKmerPos = (oSeq.llLen > 0) ? oSeq.llLen : 1;
+    long long *llpKmers = 0;
+    if ((llpKmers=(long long*)malloc(sizeof(long long)*llNofKmerPos)) == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
         exit(2);
     }
-    memset(cpSeq, '\0', sizeof(char)*INISEQLEN);
 
-    long i=0, j=0, x=0, iCurLen=0;
-    int *ipSeq=0;
-    int iLineLen=0;
-    while (fgets(sLine, INILINELEN, fFastaFile))
+    llNofKmerPos = extract_kmers(&oSeq, KMERLEN, llpKmers);
+    packed_seq_free(&oSeq);
+
+    qsort (llpKmers, llNofKmerPos, sizeof(long long), compare);
+
+    long long llNewSize=0, i=0;
+    llNewSize = rmdup(llpKmers, llNofKmerPos);
+
+    // output kmer
+    KmerListWriter oWriter;
+    klist_writer_init(&oWriter, stdout);
+    for (i=0; i<llNewSize; i++)
+        klist_write(&oWriter, llpKmers[i]);
+    klist_writer_close(&oWriter);
+
+    // written after the list, so it is never older than it
+    if (argv == 4)
     {
-        if (sLine[0] == '>')
+        FILE *fLenFile;
+        if ((fLenFile = fopen(args[3], "w")) == NULL)
         {
-            memset(sLine, '\0', sizeof(char)*INILINELEN);
-            continue;
+            fprintf(stderr, "Can't open file: %s\n", args[3]);
+            exit(1);
         }
+        fprintf(fLenFile, "%lld\n", llNewSize);
+        fclose(fLenFile);
+    }
+
+    free(llpKmers);
+
+    return 0;
+}
+// ----------------------------------------------------------------------------
+
+void packed_seq_init(PackedSeq *pSeq)
+{
+    memset(pSeq, 0, sizeof(PackedSeq));
+
+    pSeq->llAvail = INISEQLEN;
+    pSeq->ucpBases = (unsigned char*)grow_array(0, INISEQLEN/4, sizeof(unsigned char));
+    memset(pSeq->ucpBases, 0, sizeof(unsigned char)*(INISEQLEN/4));
+
+    pSeq->llAvailNRuns = ININOFRUNS;
+    pSeq->llpNStart = (long long*)grow_array(0, ININOFRUNS, sizeof(long long));
+    pSeq->llpNEnd = (long long*)grow_array(0, ININOFRUNS, sizeof(long long));
+
+    pSeq->llAvailContigs = ININOFRUNS;
+    pSeq->llpContigStart = (long long*)grow_array(0, ININOFRUNS, sizeof(long long));
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+void packed_seq_free(PackedSeq *pSeq)
+{
+    free(pSeq->ucpBases);
+    free(pSeq->llpNStart);
+    free(pSeq->llpNEnd);
+    free(pSeq->llpContigStart);
+    memset(pSeq, 0, sizeof(PackedSeq));
 
-        iLineLen = strlen(sLine)-1;
-        
-        if (iCurLen + iLineLen > iAvailLen)
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// reads the fasta file in blocks and appends every sequence character to
+// the packed sequence. header lines start a new contig, white space is
+// skipped and anything that is not ACGT is recorded as an N.
+void packed_seq_read_fasta(FILE *fFastaFile, PackedSeq *pSeq)
+{
+    char *cpBuf = 0;
+    if ((cpBuf=(char*)malloc(sizeof(char)*INIBUFLEN)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    int iInHeader = 0, iLineStart = 1;
+    size_t nRead = 0, n = 0;
+    char c = 0;
+    while ((nRead = fread(cpBuf, sizeof(char), INIBUFLEN, fFastaFile)) > 0)
+    {
+        for (n = 0; n < nRead; n++)
         {
-            if ((cpSeq2=(char*)malloc(sizeof(char)*(iAvailLen*2))) == NULL)
+            c = cpBuf[n];
+            if (c == '\n')
+            {
+                iInHeader = 0;
+                iLineStart = 1;
+                continue;
+            }
+            if (iInHeader != 0)
+                continue;
+            if (iLineStart != 0 && c == '>')
+            {
+                iInHeader = 1;
+                packed_seq_add_contig(pSeq);
+                continue;
+            }
+            iLineStart = 0;
+
+            switch (c)
             {
-                fprintf(stderr, "Memory allocation failed\n");
-                exit(2);
+                case 'A': case 'a':
+                    packed_seq_append_base(pSeq, 0);
+                    break;
+                case 'C': case 'c':
+                    packed_seq_append_base(pSeq, 1);
+                    break;
+                case 'G': case 'g':
+                    packed_seq_append_base(pSeq, 2);
+                    break;
+                case 'T': case 't':
+                    packed_seq_append_base(pSeq, 3);
+                    break;
+                case ' ': case '\t': case '\r':
+                    break;
+                default:
+                    packed_seq_append_base(pSeq, -1);
+                    break;
             }
-            iAvailLen *= 2;      
-            memset(cpSeq2, '\0', sizeof(char)*iAvailLen);
-            cpSeq -= iCurLen;
-            memcpy(cpSeq2, cpSeq, sizeof(char)*iCurLen);
-            free(cpSeq);
-            cpSeq = cpSeq2;
-            cpSeq += iCurLen;                       
         }
-        
-        memcpy(cpSeq, sLine, sizeof(char)*iLineLen);
-        cpSeq += iLineLen;
-        iCurLen += iLineLen;
-        
-        memset(sLine, '\0', sizeof(char)*INILINELEN);
-    }        
-    
-    fclose(fFastaFile);    
-
-    cpSeq -= iCurLen;
-    
-    long lNofKmerPos = (iCurLen - KMERLEN) +  1;   
-    
-    if ((ipSeq=(int*)malloc(sizeof(int)*iCurLen)) == NULL)
+    }
+
+    free(cpBuf);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// iBase is 0-3 for ACGT or -1 for anything else (stored as A plus N run)
+void packed_seq_append_base(PackedSeq *pSeq, int iBase)
+{
+    long long llPos = pSeq->llLen;
+
+    // sequence without a header line is one contig
+    if (pSeq->llNofContigs == 0)
+        packed_seq_add_contig(pSeq);
+
+    if (llPos >= pSeq->llAvail)
     {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(2);
+        pSeq->ucpBases = (unsigned char*)grow_array(pSeq->ucpBases, (pSeq->llAvail*2)/4, sizeof(unsigned char));
+        memset(pSeq->ucpBases + pSeq->llAvail/4, 0, sizeof(unsigned char)*(pSeq->llAvail/4));
+        pSeq->llAvail *= 2;
     }
-    memset(ipSeq, 0, sizeof(int)*iCurLen);
-    
-    // printf("\n%ld\n", iCurLen);    
-    
-    // convert read string to int array            
-    for (j = 0; j < iCurLen; j++)
+
+    if (iBase < 0)
     {
-        switch (toupper(cpSeq[j]))
+        if (pSeq->llNofNRuns > 0 && pSeq->llpNEnd[pSeq->llNofNRuns-1] == llPos)
+        {
+            pSeq->llpNEnd[pSeq->llNofNRuns-1] = llPos + 1;
+        }
+        else
         {
-            case 'A':
-                *ipSeq = 0;
-                break;
-            case 'C':
-                *ipSeq = 1;
-                break;
-            case 'G':
-                *ipSeq = 2;
-                break;
-            case 'T':
-                *ipSeq = 3;
-                break;
-            default:
-                *ipSeq = -1;
-                break;
+            if (pSeq->llNofNRuns >= pSeq->llAvailNRuns)
+            {
+                pSeq->llAvailNRuns *= 2;
+                pSeq->llpNStart = (long long*)grow_array(pSeq->llpNStart, pSeq->llAvailNRuns, sizeof(long long));
+                pSeq->llpNEnd = (long long*)grow_array(pSeq->llpNEnd, pSeq->llAvailNRuns, sizeof(long long));
+            }
+            pSeq->llpNStart[pSeq->llNofNRuns] = llPos;
+            pSeq->llpNEnd[pSeq->llNofNRuns] = llPos + 1;
+            pSeq->llNofNRuns++;
         }
-        ipSeq += 1;
+        iBase = 0;
     }
-    ipSeq -= iCurLen;
 
-    free(cpSeq);    
+    pSeq->ucpBases[llPos >> 2] |= (unsigned char)(iBase << ((llPos & 3) << 1));
+    pSeq->llLen++;
 
-    long long *llpKmers = 0;
-    if ((llpKmers=(long long*)malloc(sizeof(long long)*lNofKmerPos)) == NULL)
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+void packed_seq_add_contig(PackedSeq *pSeq)
+{
+    if (pSeq->llNofContigs >= pSeq->llAvailContigs)
+    {
+        pSeq->llAvailContigs *= 2;
+        pSeq->llpContigStart = (long long*)grow_array(pSeq->llpContigStart, pSeq->llAvailContigs, sizeof(long long));
+    }
+    pSeq->llpContigStart[pSeq->llNofContigs] = pSeq->llLen;
+    pSeq->llNofContigs++;
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+int packed_seq_get_base(const PackedSeq *pSeq, long long llPos)
+{
+    return (pSeq->ucpBases[llPos >> 2] >> ((llPos & 3) << 1)) & 3;
+}
+
+// ----------------------------------------------------------------------------
+
+// realloc wrapper that exits on failure
+void *grow_array(void *vpArray, long long llNewLen, size_t nElemSize)
+{
+    void *vpNew = 0;
+    if (llNewLen < 1)
+        llNewLen = 1;
+    if ((vpNew=realloc(vpArray, nElemSize*(size_t)llNewLen)) == NULL)
     {
         fprintf(stderr, "Memory allocation failed\n");
         exit(2);
     }
+    return vpNew;
+}
+
+// ----------------------------------------------------------------------------
+
+// writes the canonical kmer of every valid kmer position into llpKmers and
+// returns how many were written. consecutive duplicates are dropped here
+// already. kmers are built with a rolling update, the forward strand has the
+// first base as most significant digit, the reverse complement the first
+// base as least significant digit.
+long long extract_kmers(const PackedSeq *pSeq, int iKmerLen, long long *llpKmers)
+{
+    long long llMask = (iKmerLen < 32) ? ((1LL << (2*iKmerLen)) - 1) : -1LL;
+    int iTopShift = 2*(iKmerLen-1);
 
-    memset(llpKmers, 0, sizeof(long long)*lNofKmerPos);
+    long long llContig=0, llStart=0, llEnd=0, llPos=0, llNRun=0;
+    long long llFWD=0, llRVC=0, llThis=0, llPrev=-1, i=0;
+    int iBase=0, iValidLen=0;
 
-    int iValid = 1;
-    long double nKmerFWD=0.0, nKmerRVC=0.0;
-    
-    long long llThis=0, llPrev=-1;    
-    
-    i=0;    
-    for (j = 0; j < lNofKmerPos; j++)
+    for (llContig = 0; llContig < pSeq->llNofContigs; llContig++)
     {
-        nKmerFWD=0.0;
-        nKmerRVC=0.0;
-        iValid = 1;
-        // forward strand        
-        for (x = KMERLENMINUSONE; x >= 0; x--)
-        {
-            // check for invalid chars go to next k-mer if found                    
-            if (ipSeq[j+x] == -1) // N
-            {
-                iValid = 0;
-                break;
-            }
-            // convert kmer from base 4 to base 10 index for counting
-            nKmerFWD += ipSeq[j+x] * pow(4.0, KMERLENMINUSONE-x);
-        }
-        // reverse complement strand
-        if (iValid!=0)
+        llStart = pSeq->llpContigStart[llContig];
+        llEnd = (llContig+1 < pSeq->llNofContigs) ? pSeq->llpContigStart[llContig+1] : pSeq->llLen;
+
+        // kmers never span the join between two contigs
+        iValidLen = 0;
+        llFWD = 0;
+        llRVC = 0;
+
+        for (llPos = llStart; llPos < llEnd; llPos++)
         {
-            for (x = 0; x <= KMERLENMINUSONE; x++)
+            while (llNRun < pSeq->llNofNRuns && pSeq->llpNEnd[llNRun] <= llPos)
+                llNRun++;
+
+            if (llNRun < pSeq->llNofNRuns && pSeq->llpNStart[llNRun] <= llPos)
             {
-                // convert kmer from base 4 to base 10 index for counting
-                nKmerRVC += (3-ipSeq[j+x]) * pow(4.0, x);
+                // skip the whole N run
+                iValidLen = 0;
+                llFWD = 0;
+                llRVC = 0;
+                llPos = pSeq->llpNEnd[llNRun] - 1;
+                continue;
             }
-        }
 
-        if (iValid!=0)
-        {
-            llThis = (long long)((nKmerFWD <= nKmerRVC) ? nKmerFWD : nKmerRVC);            
+            iBase = packed_seq_get_base(pSeq, llPos);
+            llFWD = ((llFWD << 2) | iBase) & llMask;
+            llRVC = (llRVC >> 2) | ((long long)(3-iBase) << iTopShift);
+
+            if (iValidLen < iKmerLen)
+                iValidLen++;
+            if (iValidLen < iKmerLen)
+                continue;
+
+            llThis = (llFWD <= llRVC) ? llFWD : llRVC;
             if (llThis != llPrev)
-            {            
+            {
                 llpKmers[i] = llThis;
                 i++;
                 llPrev = llThis;
             }
         }
     }
-    free(ipSeq);
-    
-    lNofKmerPos  = i;
-    
-    // printf("\nProcessing time until sort: %ld secs\n", time(NULL)-start);
-
-    // use stdlib qsort instead of own nonsense    
-    // q_sort(llpKmers, 0, i-1);
-    qsort (llpKmers, i, sizeof(long long), compare);
-    
-    // printf("\nProcessing time including sort: %ld secs\n", time(NULL)-start);
-    // printf("OldSize: %ld\n", i);
-    
-    long lNewSize=0;
-    lNewSize = rmdup(llpKmers, lNofKmerPos);
-
-    // output kmer
-    for (i=0; i<lNewSize; i++)
-        printf("%lld\n",llpKmers[i]);
-    
-    
-    // printf("NewSize: %ld\n", lNewSize );    
-    // printf("Total processing time: %ld secs\n", time(NULL)-start);
-
-    free(llpKmers);
 
-    return 0;
+    return i;
 }
+
 // ----------------------------------------------------------------------------
 
 // helper function for the stdlib qsort
 int compare (const void * a, const void * b)
 {
   if ( *(long long*)a <  *(long long*)b ) return -1;
-  if ( *(long long*)a == *(long long*)b ) return 0;
   if ( *(long long*)a >  *(long long*)b ) return 1;
+  return 0;
 }
 
 // ----------------------------------------------------------------------------
 
-long rmdup(long long *a, long lLen)
+long long rmdup(long long *a, long long llLen)
 {
-    long i=1, j=0;
-    
-    for (; i < lLen; i++) 
-    { 
-        if (a[i] != a[j]) 
-        { 
-            j++; 
-            a[j] = a[i]; 
-        } 
-    }  
-
-    return j+1;
-}
+    long long i=1, j=0;
 
-// ----------------------------------------------------------------------------
+    if (llLen == 0)
+        return 0;
 
-void q_sort(long long *a, long long llL, long long llR)
-{
-    int x=0; long y=0;
-    for (y=llL; y<=llR; y++)
-        if (a[y] != 0)
-            x =1;  
-    
-    if (x==0) return;    
-    
-    long long llPivot=0,
-              llTmp1=0,
-              llTmp2=0;
- 
-    llTmp1 = llL;
-    llTmp2 = llR;
-    llPivot = a[llL];
-    while (llL < llR)
+    for (; i < llLen; i++)
     {
-        while ((a[llR] >= llPivot) && (llL < llR))
-        {
-            llR--;
-        }        
-        if (llL != llR)
-        {
-            a[llL] = a[llR];
-            llL++;
-        }
-        while ((a[llL] <= llPivot) && (llL < llR))
-        {
-            llL++;
-        }
-        if (llL != llR)
+        if (a[i] != a[j])
         {
-            a[llR] = a[llL];
-            llR--;
+            j++;
+            a[j] = a[i];
         }
     }
-    a[llL] = llPivot;
-    llPivot = llL;
-    llL = llTmp1;
-    llR = llTmp2;
-    if (llL < llPivot)
-    {
-        q_sort(a, llL, llPivot-1);
-    }
-    if (llR > llPivot)
-    {
-        return q_sort(a, llPivot+1, llR);
-    }
-    
-    return;
+
+    return j+1;
 }
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,60 @@
+/* ***************************************************************
+
+Index format and hash functions shared by kmer_sbt_build and
+kmer_sbt_query. See kmer_sbt_build.c for the file layout.
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#ifndef KMER_SBT_H
+#define KMER_SBT_H
+
+#include "kmer_hash.h"
+
+#define SBT_MAGIC "KSBT"
+#define SBT_VERSION 2
+#define SBT_MINLOG2BITS 16
+#define SBT_MAXLOG2BITS 36
+#define SBT_NOFHASHES 3         // bit positions per kmer in every filter
+#define SBT_BITSPERKMER 16      // 0.5% false positives at 3 hashes
+#define SBT_SLICEBITS 65536     // sampled bits per node used to build the tree
+
+typedef struct
+{
+    char caMagic[4];
+    int iVersion;
+    int iMaxLog2Bits;           // size of the largest filter
+    int iNofHashes;
+    int iNofLeaves;
+    int iNofNodes;
+} SbtHeader;
+
+typedef struct
+{
+    int iLeft, iRight;          // child nodes, -1 for leaves
+    int iLeaf;                  // leaf number, -1 for internal nodes
+    int iLog2Bits;              // the filter has 2^iLog2Bits bits, 0 for leaves
+    long long llMinLeafKmers;   // size of the smallest kmer list in this subtree
+    long long llBitsOffset;     // file offset of the Bloom filter, -1 for leaves
+} SbtNode;
+
+typedef struct
+{
+    long long llNofKmers;
+    int iPathLen;
+} SbtLeaf;
+
+// i-th bit position of a kmer_hash value in a filter of 2^iLog2Bits bits,
+// by double hashing with the two halves of the hash swapped as the step.
+// the first position is the hash itself, so filters of different size
+// share it.
+static inline unsigned long long sbt_bit(unsigned long long ullHash, int i, int iLog2Bits)
+{
+    unsigned long long ullStep = ((ullHash >> 32) | (ullHash << 32)) | 1ULL;
+    return (ullHash + (unsigned long long)i * ullStep) & ((1ULL << iLog2Bits) - 1);
+}
+
+#endif
+
+// eof
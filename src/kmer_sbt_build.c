@@ -0,0 +1,427 @@
+/* ***************************************************************
+
+Builds a sequence Bloom tree (SBT) index over a set of kmer list files,
+usually the centroids of all reference groups. Every list becomes a
+leaf. Internal nodes hold a Bloom filter of the union of the kmers in
+their subtree. Nodes are paired bottom-up, always joining the two most
+similar nodes of a level first, so genomes from the same group end up
+in the same subtree.
+
+Every filter is sized for the kmers below its node, SBT_BITSPERKMER bits
+per kmer with SBT_NOFHASHES hashes, so the filters higher up in the tree
+do not fill up and still give useful bounds. Filters are capped at
+2^maxlog2bits bits, nodes above that size fill up more.
+
+The lists are read twice. The first pass counts the kmers of each list
+and keeps a sample of SBT_SLICEBITS bits of a common size filter, which
+is all that is needed to pair the nodes and to estimate how many
+distinct kmers each internal node holds. The second pass walks the tree
+depth first and adds the kmers of each leaf to the filters of all its
+ancestors, which are the only filters in memory at that time. A filter
+is written out as soon as its subtree is done, so memory use is at most
+about twice the largest filter, independent of the number of leaves.
+
+Leaves do not store a filter in the index. kmer_sbt_query computes
+exact similarities for them from the original kmer list files.
+
+Index layout (native byte order):
+    SbtHeader
+    SbtNode  x iNofNodes      (root is the last node)
+    SbtLeaf  x iNofLeaves     (each followed by its path, no '\0')
+    bit arrays of the internal nodes, 2^iLog2Bits bits each
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libgen.h>
+
+#include "kmer_sbt.h"
+#include "kmer_list_io.h"
+
+#define MAXDEPTH 4096
+
+void displayUsage(char*);
+unsigned long long *load_leaf_slice(const char *sFile, int iSliceLog2, long long llSliceWords);
+double slice_similarity(const unsigned long long *a, const unsigned long long *b, long long llWords);
+long long estimate_kmers(const unsigned long long *ullpSlice, long long llSliceWords, int iSliceLog2);
+int filter_log2bits(long long llNofKmers, int iMaxLog2Bits);
+void build_filters(int iNode, SbtNode *pNodes, char **spFiles, unsigned long long **ullpPath,
+                   int *ipPathLog2, int iDepth, FILE *fIndex, const char *sIndex);
+int compare_pairs(const void * a, const void * b);
+
+typedef struct
+{
+    double flSim;
+    int iA, iB;
+} SbtPair;
+
+// --------------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        displayUsage(argv[0]);
+        exit(1);
+    }
+
+    int iMaxLog2Bits = atoi(argv[1]);
+    if (iMaxLog2Bits < SBT_MINLOG2BITS || iMaxLog2Bits > SBT_MAXLOG2BITS)
+    {
+        fprintf(stderr, "maxlog2bits must be between %d and %d\n", SBT_MINLOG2BITS, SBT_MAXLOG2BITS);
+        exit(1);
+    }
+
+    int iNofLeaves = argc - 3;
+    int iNofNodes = 2*iNofLeaves - 1;
+    int i=0, j=0, k=0;
+
+    SbtHeader oHeader;
+    memset(&oHeader, 0, sizeof(SbtHeader));
+    memcpy(oHeader.caMagic, SBT_MAGIC, 4);
+    oHeader.iVersion = SBT_VERSION;
+    oHeader.iMaxLog2Bits = iMaxLog2Bits;
+    oHeader.iNofHashes = SBT_NOFHASHES;
+    oHeader.iNofLeaves = iNofLeaves;
+    oHeader.iNofNodes = iNofNodes;
+
+    SbtNode *pNodes;
+    SbtLeaf *pLeaves;
+    unsigned long long **ullpSlices;
+    long long *llpNodeKmers;
+    int *ipActive, *ipNextActive;
+    SbtPair *pPairs;
+    if ((pNodes=(SbtNode*)malloc(sizeof(SbtNode)*iNofNodes)) == NULL ||
+        (pLeaves=(SbtLeaf*)malloc(sizeof(SbtLeaf)*iNofLeaves)) == NULL ||
+        (ullpSlices=(unsigned long long**)malloc(sizeof(unsigned long long*)*iNofNodes)) == NULL ||
+        (llpNodeKmers=(long long*)malloc(sizeof(long long)*iNofNodes)) == NULL ||
+        (ipActive=(int*)malloc(sizeof(int)*iNofLeaves)) == NULL ||
+        (ipNextActive=(int*)malloc(sizeof(int)*iNofLeaves)) == NULL ||
+        (pPairs=(SbtPair*)malloc(sizeof(SbtPair)*((long long)iNofLeaves*iNofLeaves/2+1))) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    memset(pNodes, 0, sizeof(SbtNode)*iNofNodes);
+    memset(pLeaves, 0, sizeof(SbtLeaf)*iNofLeaves);
+    memset(ullpSlices, 0, sizeof(unsigned long long*)*iNofNodes);
+
+    // the samples are taken from a filter sized for the largest list
+    long long llMaxKmers = 1;
+    for (i = 0; i < iNofLeaves; i++)
+    {
+        pLeaves[i].llNofKmers = klist_count(argv[i+3]);
+        if (pLeaves[i].llNofKmers > llMaxKmers)
+            llMaxKmers = pLeaves[i].llNofKmers;
+    }
+    int iSliceLog2 = filter_log2bits(llMaxKmers, SBT_MAXLOG2BITS);
+    long long llSliceWords = ((1LL << iSliceLog2) < SBT_SLICEBITS ? (1LL << iSliceLog2) : SBT_SLICEBITS) / 64;
+
+    // leaves
+    for (i = 0; i < iNofLeaves; i++)
+    {
+        ullpSlices[i] = load_leaf_slice(argv[i+3], iSliceLog2, llSliceWords);
+        llpNodeKmers[i] = pLeaves[i].llNofKmers;
+        pLeaves[i].iPathLen = strlen(argv[i+3]);
+        pNodes[i].iLeft = -1;
+        pNodes[i].iRight = -1;
+        pNodes[i].iLeaf = i;
+        pNodes[i].iLog2Bits = 0;
+        pNodes[i].llMinLeafKmers = pLeaves[i].llNofKmers;
+        pNodes[i].llBitsOffset = -1;
+        ipActive[i] = i;
+    }
+
+    // pair the most similar nodes of each level until only the root is left
+    int iNofActive = iNofLeaves, iNext = iNofLeaves, iNofPairs = 0, iNofNextActive = 0;
+    long long w=0, llLow=0, llHigh=0;
+    while (iNofActive > 1)
+    {
+        iNofPairs = 0;
+        for (i = 0; i < iNofActive; i++)
+        {
+            for (j = i+1; j < iNofActive; j++)
+            {
+                pPairs[iNofPairs].flSim = slice_similarity(ullpSlices[ipActive[i]], ullpSlices[ipActive[j]], llSliceWords);
+                pPairs[iNofPairs].iA = i;
+                pPairs[iNofPairs].iB = j;
+                iNofPairs++;
+            }
+        }
+        qsort(pPairs, iNofPairs, sizeof(SbtPair), compare_pairs);
+
+        iNofNextActive = 0;
+        for (k = 0; k < iNofPairs; k++)
+        {
+            i = pPairs[k].iA;
+            j = pPairs[k].iB;
+            if (ipActive[i] < 0 || ipActive[j] < 0)
+                continue;
+
+            SbtNode *pNode = &pNodes[iNext];
+            SbtNode *pLeft = &pNodes[ipActive[i]];
+            SbtNode *pRight = &pNodes[ipActive[j]];
+            pNode->iLeft = ipActive[i];
+            pNode->iRight = ipActive[j];
+            pNode->iLeaf = -1;
+            pNode->llMinLeafKmers = (pLeft->llMinLeafKmers < pRight->llMinLeafKmers) ?
+                                     pLeft->llMinLeafKmers : pRight->llMinLeafKmers;
+
+            // the parent reuses the left sample, the right one is no longer needed
+            unsigned long long *ullpL = ullpSlices[ipActive[i]];
+            unsigned long long *ullpR = ullpSlices[ipActive[j]];
+            for (w = 0; w < llSliceWords; w++)
+                ullpL[w] |= ullpR[w];
+            free(ullpR);
+            ullpSlices[ipActive[i]] = 0;
+            ullpSlices[ipActive[j]] = 0;
+            ullpSlices[iNext] = ullpL;
+
+            // the union has at least as many kmers as the larger child and
+            // at most as many as both together
+            llLow = llpNodeKmers[ipActive[i]];
+            llHigh = llpNodeKmers[ipActive[i]] + llpNodeKmers[ipActive[j]];
+            if (llpNodeKmers[ipActive[j]] > llLow)
+                llLow = llpNodeKmers[ipActive[j]];
+            llpNodeKmers[iNext] = estimate_kmers(ullpL, llSliceWords, iSliceLog2);
+            if (llpNodeKmers[iNext] < llLow)
+                llpNodeKmers[iNext] = llLow;
+            if (llpNodeKmers[iNext] > llHigh)
+                llpNodeKmers[iNext] = llHigh;
+            pNode->iLog2Bits = filter_log2bits(llpNodeKmers[iNext], iMaxLog2Bits);
+
+            ipActive[i] = -1;
+            ipActive[j] = -1;
+            ipNextActive[iNofNextActive] = iNext;
+            iNofNextActive++;
+            iNext++;
+        }
+
+        for (i = 0; i < iNofActive; i++)
+        {
+            // the odd one out moves up a level unchanged
+            if (ipActive[i] >= 0)
+            {
+                ipNextActive[iNofNextActive] = ipActive[i];
+                iNofNextActive++;
+            }
+        }
+        memcpy(ipActive, ipNextActive, sizeof(int)*iNofNextActive);
+        iNofActive = iNofNextActive;
+    }
+    free(ullpSlices[ipActive[0]]);
+
+    FILE *fIndex;
+    if ((fIndex = fopen(argv[2], "wb")) == NULL)
+    {
+        fprintf(stderr, "Can't open file: %s\n", argv[2]);
+        exit(1);
+    }
+
+    // reserve space for the tables, the filters are appended as they are done
+    long long llOffset = sizeof(SbtHeader) + sizeof(SbtNode)*iNofNodes + sizeof(SbtLeaf)*iNofLeaves;
+    for (i = 0; i < iNofLeaves; i++)
+        llOffset += pLeaves[i].iPathLen;
+    fseek(fIndex, llOffset, SEEK_SET);
+
+    unsigned long long *ullpPath[MAXDEPTH];
+    int ipPathLog2[MAXDEPTH];
+    build_filters(iNofNodes-1, pNodes, argv+3, ullpPath, ipPathLog2, 0, fIndex, argv[2]);
+
+    // now write the tables at the front
+    fseek(fIndex, 0, SEEK_SET);
+    fwrite(&oHeader, sizeof(SbtHeader), 1, fIndex);
+    fwrite(pNodes, sizeof(SbtNode), iNofNodes, fIndex);
+    for (i = 0; i < iNofLeaves; i++)
+    {
+        fwrite(&pLeaves[i], sizeof(SbtLeaf), 1, fIndex);
+        fwrite(argv[i+3], sizeof(char), pLeaves[i].iPathLen, fIndex);
+    }
+
+    if (fclose(fIndex) != 0)
+    {
+        fprintf(stderr, "Can't write file: %s\n", argv[2]);
+        exit(1);
+    }
+
+    free(pNodes);
+    free(pLeaves);
+    free(ullpSlices);
+    free(llpNodeKmers);
+    free(ipActive);
+    free(ipNextActive);
+    free(pPairs);
+
+    return 0;
+}
+
+//---------------------------------------------------------------
+void displayUsage(char* parent)
+{
+    char *app;
+    char *path = strdup(parent);
+    app = basename(path);
+    fprintf(stdout, "\nUsage: %s [maxlog2bits] [index.sbt] [refkmerlist_1] [refkmerlist_2] ... [refkmerlist_n]\n", app);
+    fprintf(stdout, " [maxlog2bits]       - No Bloom filter has more than 2^maxlog2bits bits [e.g. 32 (512MB)]\n");
+    fprintf(stdout, " [index.sbt]         - Output index file\n");
+    fprintf(stdout, " [refkmerlist_1,2,n] - Files containing sorted kmers, one leaf of the tree each\n\n");
+    free(path);
+}
+
+// ----------------------------------------------------------------------------
+
+// reads a kmer list and returns the first llSliceWords words of its Bloom
+// filter of 2^iSliceLog2 bits with a single hash
+unsigned long long *load_leaf_slice(const char *sFile, int iSliceLog2, long long llSliceWords)
+{
+    KmerListReader oReader;
+    klist_open(&oReader, sFile);
+
+    unsigned long long *ullpBits;
+    if ((ullpBits=(unsigned long long*)malloc(sizeof(unsigned long long)*llSliceWords)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    memset(ullpBits, 0, sizeof(unsigned long long)*llSliceWords);
+
+    long long llKmer = 0;
+    unsigned long long ullBit = 0, ullSliceBits = (unsigned long long)llSliceWords * 64;
+    while (klist_next(&oReader, &llKmer) != 0)
+    {
+        ullBit = sbt_bit(kmer_hash(llKmer), 0, iSliceLog2);
+        if (ullBit < ullSliceBits)
+            ullpBits[ullBit >> 6] |= (1ULL << (ullBit & 63));
+    }
+    klist_close(&oReader);
+
+    return ullpBits;
+}
+
+// ----------------------------------------------------------------------------
+
+// number of distinct kmers in a single hash filter of 2^iSliceLog2 bits,
+// estimated from the fraction of set bits in the sample
+long long estimate_kmers(const unsigned long long *ullpSlice, long long llSliceWords, int iSliceLog2)
+{
+    long long w=0, llSet=0;
+    for (w = 0; w < llSliceWords; w++)
+        llSet += __builtin_popcountll(ullpSlice[w]);
+
+    // full, nothing can be said
+    if (llSet >= llSliceWords * 64)
+        return 1LL << 62;
+
+    return (long long)(-(double)(1LL << iSliceLog2) * log(1.0 - (double)llSet / (double)(llSliceWords * 64)));
+}
+
+// ----------------------------------------------------------------------------
+
+// smallest filter with SBT_BITSPERKMER bits per kmer
+int filter_log2bits(long long llNofKmers, int iMaxLog2Bits)
+{
+    int iLog2Bits = SBT_MINLOG2BITS;
+    while (iLog2Bits < iMaxLog2Bits && (1LL << iLog2Bits) < llNofKmers * SBT_BITSPERKMER)
+        iLog2Bits++;
+
+    return iLog2Bits;
+}
+
+// ----------------------------------------------------------------------------
+
+// depth first. an internal node gets its filter added to the path, a leaf
+// adds its kmers to every filter on the path. a filter is written and freed
+// when both its subtrees are done.
+void build_filters(int iNode, SbtNode *pNodes, char **spFiles, unsigned long long **ullpPath,
+                   int *ipPathLog2, int iDepth, FILE *fIndex, const char *sIndex)
+{
+    SbtNode *pNode = &pNodes[iNode];
+    int d=0, h=0;
+
+    if (pNode->iLeaf >= 0)
+    {
+        KmerListReader oReader;
+        long long llKmer = 0;
+        unsigned long long ullHash = 0, ullBit = 0;
+        klist_open(&oReader, spFiles[pNode->iLeaf]);
+        while (klist_next(&oReader, &llKmer) != 0)
+        {
+            ullHash = kmer_hash(llKmer);
+            for (d = 0; d < iDepth; d++)
+            {
+                for (h = 0; h < SBT_NOFHASHES; h++)
+                {
+                    ullBit = sbt_bit(ullHash, h, ipPathLog2[d]);
+                    ullpPath[d][ullBit >> 6] |= (1ULL << (ullBit & 63));
+                }
+            }
+        }
+        klist_close(&oReader);
+        return;
+    }
+
+    if (iDepth >= MAXDEPTH)
+    {
+        fprintf(stderr, "Tree too deep\n");
+        exit(1);
+    }
+
+    long long llWords = ((1LL << pNode->iLog2Bits) + 63) / 64;
+    if ((ullpPath[iDepth]=(unsigned long long*)malloc(sizeof(unsigned long long)*llWords)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    memset(ullpPath[iDepth], 0, sizeof(unsigned long long)*llWords);
+    ipPathLog2[iDepth] = pNode->iLog2Bits;
+
+    build_filters(pNode->iLeft, pNodes, spFiles, ullpPath, ipPathLog2, iDepth+1, fIndex, sIndex);
+    build_filters(pNode->iRight, pNodes, spFiles, ullpPath, ipPathLog2, iDepth+1, fIndex, sIndex);
+
+    pNode->llBitsOffset = ftell(fIndex);
+    if (fwrite(ullpPath[iDepth], sizeof(unsigned long long), llWords, fIndex) != (size_t)llWords)
+    {
+        fprintf(stderr, "Can't write file: %s\n", sIndex);
+        exit(1);
+    }
+    free(ullpPath[iDepth]);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// Jaccard index of the set bits in two samples. the hash is uniform, so
+// any slice of the bit array is a random sample.
+double slice_similarity(const unsigned long long *a, const unsigned long long *b, long long llWords)
+{
+    long long w=0, llAnd=0, llOr=0;
+    for (w = 0; w < llWords; w++)
+    {
+        llAnd += __builtin_popcountll(a[w] & b[w]);
+        llOr += __builtin_popcountll(a[w] | b[w]);
+    }
+    return (llOr > 0) ? (double)llAnd / (double)llOr : 0.0;
+}
+
+// ----------------------------------------------------------------------------
+
+// helper function for the stdlib qsort, most similar pair first
+int compare_pairs(const void * a, const void * b)
+{
+    const SbtPair *pA = (const SbtPair*)a;
+    const SbtPair *pB = (const SbtPair*)b;
+    if (pA->flSim > pB->flSim) return -1;
+    if (pA->flSim < pB->flSim) return 1;
+    if (pA->iA != pB->iA) return pA->iA - pB->iA;
+    return pA->iB - pB->iB;
+}
+
+// ----------------------------------------------------------------------------
+
+// eof
@@ -0,0 +1,355 @@
+/* ***************************************************************
+
+Queries a sequence Bloom tree built by kmer_sbt_build with the kmer
+list of a read set and prints the similarity between the reads and
+the best matching leaves in the same format as
+intersect_kmer_lists_filelist, best hit first.
+
+The tree is searched best-first. The number of read kmers found in
+the Bloom filter of an internal node, divided by the size of the
+smallest kmer list below it, is an upper bound for the similarity of
+any leaf in that subtree (false positives only ever raise it). Only
+subtrees whose bound reaches minsim and can still make it into the top
+n are opened. Similarities of leaves are exact.
+
+Most of the pruning comes from minsim. Leaves below it are not
+reported, even if fewer than n leaves reach it. With minsim 0 and n
+larger than the number of groups with real hits, the n-th best leaf is
+at noise level, no bound falls below it, and the whole tree is opened.
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libgen.h>
+
+#include "kmer_sbt.h"
+#include "kmer_list_io.h"
+
+typedef struct
+{
+    double flKey;   // bound for internal nodes, exact similarity for leaves
+    int iNode;
+    int iExact;
+} SbtEntry;
+
+typedef struct
+{
+    SbtEntry *pEntries;
+    int iLen, iAvail;
+} SbtHeap;
+
+void displayUsage(char*);
+double node_bound(FILE *fIndex, const SbtHeader *pHeader, const SbtNode *pNode,
+                  const unsigned long long *ullpHashes, unsigned long long *ullpFilter, long long llNofHashes);
+float leaf_similarity(const char *sFile, const long long *llpReads, long long llNofReads);
+void open_node(FILE *fIndex, const SbtHeader *pHeader, const SbtNode *pNodes, char **spPaths, int iNode,
+               const long long *llpReads, const unsigned long long *ullpHashes, long long llNofReads,
+               unsigned long long *ullpFilter, double flMinSim, SbtHeap *pHeap);
+void heap_push(SbtHeap *pHeap, SbtEntry oEntry);
+SbtEntry heap_pop(SbtHeap *pHeap);
+int entry_before(const SbtEntry *a, const SbtEntry *b);
+
+// --------------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    if (argc != 5)
+    {
+        displayUsage(argv[0]);
+        exit(1);
+    }
+
+    int iTopN = atoi(argv[3]);
+    double flMinSim = atof(argv[4]);
+    int i=0;
+
+    FILE *fIndex;
+    if ((fIndex = fopen(argv[1], "rb")) == NULL)
+    {
+        fprintf(stderr, "Can't open file: %s\n", argv[1]);
+        exit(1);
+    }
+
+    SbtHeader oHeader;
+    if (fread(&oHeader, sizeof(SbtHeader), 1, fIndex) != 1 ||
+        memcmp(oHeader.caMagic, SBT_MAGIC, 4) != 0 || oHeader.iVersion != SBT_VERSION)
+    {
+        fprintf(stderr, "Not a kmer SBT index: %s\n", argv[1]);
+        exit(1);
+    }
+
+    SbtNode *pNodes;
+    char **spPaths;
+    if ((pNodes=(SbtNode*)malloc(sizeof(SbtNode)*oHeader.iNofNodes)) == NULL ||
+        (spPaths=(char**)malloc(sizeof(char*)*oHeader.iNofLeaves)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    if (fread(pNodes, sizeof(SbtNode), oHeader.iNofNodes, fIndex) != (size_t)oHeader.iNofNodes)
+    {
+        fprintf(stderr, "Truncated index: %s\n", argv[1]);
+        exit(1);
+    }
+
+    SbtLeaf oLeaf;
+    for (i = 0; i < oHeader.iNofLeaves; i++)
+    {
+        if (fread(&oLeaf, sizeof(SbtLeaf), 1, fIndex) != 1 ||
+            (spPaths[i]=(char*)malloc(sizeof(char)*(oLeaf.iPathLen+1))) == NULL ||
+            fread(spPaths[i], sizeof(char), oLeaf.iPathLen, fIndex) != (size_t)oLeaf.iPathLen)
+        {
+            fprintf(stderr, "Truncated index: %s\n", argv[1]);
+            exit(1);
+        }
+        spPaths[i][oLeaf.iPathLen] = '\0';
+    }
+
+    // read kmers and their hashes, the bit positions in filters of any
+    // size are derived from those
+    long long llNofReads = 0, x = 0;
+    long long *llpReads = klist_load(argv[2], &llNofReads);
+    unsigned long long *ullpHashes;
+    if ((ullpHashes=(unsigned long long*)malloc(sizeof(unsigned long long)*(llNofReads+1))) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+    for (x = 0; x < llNofReads; x++)
+        ullpHashes[x] = kmer_hash(llpReads[x]);
+
+    unsigned long long *ullpFilter;
+    if ((ullpFilter=(unsigned long long*)malloc(sizeof(unsigned long long)*(((1LL << oHeader.iMaxLog2Bits)+63)/64))) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    SbtHeap oHeap;
+    oHeap.iLen = 0;
+    oHeap.iAvail = 64;
+    if ((oHeap.pEntries=(SbtEntry*)malloc(sizeof(SbtEntry)*oHeap.iAvail)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    // the root is treated like the only child of a virtual node
+    open_node(fIndex, &oHeader, pNodes, spPaths, oHeader.iNofNodes-1, llpReads, ullpHashes, llNofReads,
+              ullpFilter, flMinSim, &oHeap);
+
+    int iReported = 0;
+    SbtEntry oEntry;
+    float flSim = 0.0, flDist = 0.0;
+    while (oHeap.iLen > 0 && (iTopN <= 0 || iReported < iTopN))
+    {
+        oEntry = heap_pop(&oHeap);
+        if (oEntry.iExact != 0)
+        {
+            // nothing left in the heap can beat this one
+            flSim = (float)oEntry.flKey;
+            flDist = 100.0 - flSim;
+            fprintf(stdout, "%f\t%f\t%s\n", flSim, flDist, spPaths[pNodes[oEntry.iNode].iLeaf]);
+            iReported++;
+            continue;
+        }
+        open_node(fIndex, &oHeader, pNodes, spPaths, pNodes[oEntry.iNode].iLeft, llpReads, ullpHashes, llNofReads,
+                  ullpFilter, flMinSim, &oHeap);
+        open_node(fIndex, &oHeader, pNodes, spPaths, pNodes[oEntry.iNode].iRight, llpReads, ullpHashes, llNofReads,
+                  ullpFilter, flMinSim, &oHeap);
+    }
+
+    fclose(fIndex);
+    for (i = 0; i < oHeader.iNofLeaves; i++)
+        free(spPaths[i]);
+    free(spPaths);
+    free(pNodes);
+    free(llpReads);
+    free(ullpHashes);
+    free(ullpFilter);
+    free(oHeap.pEntries);
+
+    return 0;
+}
+
+//---------------------------------------------------------------
+void displayUsage(char* parent)
+{
+    char *app;
+    char *path = strdup(parent);
+    app = basename(path);
+    fprintf(stdout, "\nUsage: %s [index.sbt] [readkmerlist] [topn] [minsim]\n", app);
+    fprintf(stdout, " [index.sbt]    - Index made by kmer_sbt_build\n");
+    fprintf(stdout, " [readkmerlist] - File containing a list of sorted kmers from the reads\n");
+    fprintf(stdout, " [topn]         - Report the n most similar leaves [0: all above minsim]\n");
+    fprintf(stdout, " [minsim]       - Do not report or descend below this similarity [e.g. 0.0]\n\n");
+    free(path);
+}
+
+// ----------------------------------------------------------------------------
+
+// adds a node to the heap, leaves with their exact similarity and internal
+// nodes with their upper bound. nodes below flMinSim are dropped.
+void open_node(FILE *fIndex, const SbtHeader *pHeader, const SbtNode *pNodes, char **spPaths, int iNode,
+               const long long *llpReads, const unsigned long long *ullpHashes, long long llNofReads,
+               unsigned long long *ullpFilter, double flMinSim, SbtHeap *pHeap)
+{
+    SbtEntry oEntry;
+    oEntry.iNode = iNode;
+
+    if (pNodes[iNode].iLeaf >= 0)
+    {
+        oEntry.flKey = leaf_similarity(spPaths[pNodes[iNode].iLeaf], llpReads, llNofReads);
+        oEntry.iExact = 1;
+    }
+    else
+    {
+        oEntry.flKey = node_bound(fIndex, pHeader, &pNodes[iNode], ullpHashes, ullpFilter, llNofReads);
+        oEntry.iExact = 0;
+    }
+
+    if (oEntry.flKey >= flMinSim)
+        heap_push(pHeap, oEntry);
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+double node_bound(FILE *fIndex, const SbtHeader *pHeader, const SbtNode *pNode,
+                  const unsigned long long *ullpHashes, unsigned long long *ullpFilter, long long llNofHashes)
+{
+    long long llWords = ((1LL << pNode->iLog2Bits) + 63) / 64;
+    if (fseek(fIndex, pNode->llBitsOffset, SEEK_SET) != 0 ||
+        fread(ullpFilter, sizeof(unsigned long long), llWords, fIndex) != (size_t)llWords)
+    {
+        fprintf(stderr, "Truncated index\n");
+        exit(1);
+    }
+
+    // a kmer is in the filter if all its bits are set
+    long long x = 0, llHits = 0;
+    unsigned long long ullBit = 0;
+    int h = 0;
+    for (x = 0; x < llNofHashes; x++)
+    {
+        for (h = 0; h < pHeader->iNofHashes; h++)
+        {
+            ullBit = sbt_bit(ullpHashes[x], h, pNode->iLog2Bits);
+            if (((ullpFilter[ullBit >> 6] >> (ullBit & 63)) & 1) == 0)
+                break;
+        }
+        if (h == pHeader->iNofHashes)
+            llHits++;
+    }
+
+    if (pNode->llMinLeafKmers <= 0)
+        return 100.0;
+
+    double flBound = (double)llHits * 100.0 / (double)pNode->llMinLeafKmers;
+    return (flBound < 100.0) ? flBound : 100.0;
+}
+
+// ----------------------------------------------------------------------------
+
+// percentage of kmers in the reference seen in the reads as well,
+// computed exactly like intersect_kmer_lists_filelist does
+float leaf_similarity(const char *sFile, const long long *llpReads, long long llNofReads)
+{
+    KmerListReader oReader;
+    klist_open(&oReader, sFile);
+
+    long long llKmer = 0, llLen = 0, i = 0, c = 0;
+    while (klist_next(&oReader, &llKmer) != 0)
+    {
+        llLen++;
+        while (i < llNofReads && llpReads[i] < llKmer)
+            i++;
+        if (i < llNofReads && llpReads[i] == llKmer)
+        {
+            i++; c++;
+        }
+    }
+    klist_close(&oReader);
+
+    if (llLen == 0)
+        return 0.0;
+
+    return (float)c / ( (float)llLen / 100.0);
+}
+
+// ----------------------------------------------------------------------------
+
+// max heap on flKey, exact entries first on ties
+int entry_before(const SbtEntry *a, const SbtEntry *b)
+{
+    if (a->flKey != b->flKey)
+        return a->flKey > b->flKey;
+    return a->iExact > b->iExact;
+}
+
+// ----------------------------------------------------------------------------
+
+void heap_push(SbtHeap *pHeap, SbtEntry oEntry)
+{
+    SbtEntry *pEntries2 = 0, oTmp;
+    if (pHeap->iLen >= pHeap->iAvail)
+    {
+        if ((pEntries2=(SbtEntry*)realloc(pHeap->pEntries, sizeof(SbtEntry)*pHeap->iAvail*2)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(2);
+        }
+        pHeap->pEntries = pEntries2;
+        pHeap->iAvail *= 2;
+    }
+
+    int i = pHeap->iLen, p = 0;
+    pHeap->pEntries[i] = oEntry;
+    pHeap->iLen++;
+    while (i > 0)
+    {
+        p = (i-1)/2;
+        if (!entry_before(&pHeap->pEntries[i], &pHeap->pEntries[p]))
+            break;
+        oTmp = pHeap->pEntries[p];
+        pHeap->pEntries[p] = pHeap->pEntries[i];
+        pHeap->pEntries[i] = oTmp;
+        i = p;
+    }
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+SbtEntry heap_pop(SbtHeap *pHeap)
+{
+    SbtEntry oTop = pHeap->pEntries[0], oTmp;
+    pHeap->iLen--;
+    pHeap->pEntries[0] = pHeap->pEntries[pHeap->iLen];
+
+    int i = 0, c = 0;
+    while ((c = 2*i+1) < pHeap->iLen)
+    {
+        if (c+1 < pHeap->iLen && entry_before(&pHeap->pEntries[c+1], &pHeap->pEntries[c]))
+            c++;
+        if (!entry_before(&pHeap->pEntries[c], &pHeap->pEntries[i]))
+            break;
+        oTmp = pHeap->pEntries[c];
+        pHeap->pEntries[c] = pHeap->pEntries[i];
+        pHeap->pEntries[i] = oTmp;
+        i = c;
+    }
+
+    return oTop;
+}
+
+// ----------------------------------------------------------------------------
+
+// eof
@@ -0,0 +1,198 @@
+/* ***************************************************************
+
+Takes a list of input kmer list files and estimates the Jaccard index
+between all pairs of them from bottom-s MinHash sketches, i.e. the s
+smallest hash values of the kmers in each list.
+
+Every list is read once. The estimate for a pair is the fraction of the
+s smallest hashes of the union of both sketches that is present in both.
+Its standard error is about sqrt(J*(1-J)/s).
+
+Prints one line per pair in the format of kmer_jaccard_index:
+
+[jaccard estimate]	[file i]	[file j]
+
+Author: agent@local 19Oct2026
+
+*************************************************************** */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <libgen.h>
+
+#include "kmer_list_io.h"
+#include "kmer_hash.h"
+
+void displayUsage(char*);
+long long make_sketch(const char *sFile, unsigned long long *ullpSketch, long long llSize);
+void heap_sift_down(unsigned long long *a, long long llLen, long long i);
+long double sketch_jaccard(const unsigned long long *a, long long llLenA,
+                           const unsigned long long *b, long long llLenB, long long llSize);
+int compare (const void * a, const void * b);
+
+// --------------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        displayUsage(argv[0]);
+        exit(1);
+    }
+
+    long long llSize = atoll(argv[1]);
+    if (llSize < 1)
+    {
+        fprintf(stderr, "sketch size must be positive\n");
+        exit(1);
+    }
+
+    int iNofFiles = argc - 2, i = 0, j = 0;
+    unsigned long long **ullpSketches;
+    long long *llpLens;
+    if ((ullpSketches=(unsigned long long**)malloc(sizeof(unsigned long long*)*iNofFiles)) == NULL ||
+        (llpLens=(long long*)malloc(sizeof(long long)*iNofFiles)) == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(2);
+    }
+
+    for (i = 0; i < iNofFiles; i++)
+    {
+        if ((ullpSketches[i]=(unsigned long long*)malloc(sizeof(unsigned long long)*llSize)) == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(2);
+        }
+        llpLens[i] = make_sketch(argv[i+2], ullpSketches[i], llSize);
+    }
+
+    for (i = 0; i < iNofFiles; i++)
+    {
+        for (j = i+1; j < iNofFiles; j++)
+        {
+            printf("%Lf\t%s\t%s\n", sketch_jaccard(ullpSketches[i], llpLens[i], ullpSketches[j], llpLens[j], llSize),
+                   argv[i+2], argv[j+2]);
+        }
+    }
+
+    for (i = 0; i < iNofFiles; i++)
+        free(ullpSketches[i]);
+    free(ullpSketches);
+    free(llpLens);
+
+    return 0;
+}
+
+//---------------------------------------------------------------
+void displayUsage(char* parent)
+{
+    char *app;
+    char *path = strdup(parent);
+    app = basename(path);
+    fprintf(stdout, "\nUsage: %s [sketchsize] [refkmerlist_1] [refkmerlist_2] ... [refkmerlist_n]\n", app);
+    fprintf(stdout, " [sketchsize]        - Number of hashes kept per list [e.g. 5000]\n");
+    fprintf(stdout, " [refkmerlist_1,2,n] - Files containing kmers\n\n");
+    free(path);
+}
+
+// ----------------------------------------------------------------------------
+
+// keeps the llSize smallest hashes of a kmer list in a max heap and
+// returns them sorted ascendingly. returns the number of hashes kept.
+long long make_sketch(const char *sFile, unsigned long long *ullpSketch, long long llSize)
+{
+    KmerListReader oReader;
+    klist_open(&oReader, sFile);
+
+    long long llKmer = 0, llLen = 0, i = 0;
+    unsigned long long ullHash = 0;
+    while (klist_next(&oReader, &llKmer) != 0)
+    {
+        ullHash = kmer_hash(llKmer);
+        if (llLen < llSize)
+        {
+            ullpSketch[llLen] = ullHash;
+            llLen++;
+            if (llLen == llSize)
+            {
+                for (i = llLen/2 - 1; i >= 0; i--)
+                    heap_sift_down(ullpSketch, llLen, i);
+            }
+        }
+        else if (ullHash < ullpSketch[0])
+        {
+            ullpSketch[0] = ullHash;
+            heap_sift_down(ullpSketch, llLen, 0);
+        }
+    }
+    klist_close(&oReader);
+
+    qsort(ullpSketch, llLen, sizeof(unsigned long long), compare);
+
+    return llLen;
+}
+
+// ----------------------------------------------------------------------------
+
+void heap_sift_down(unsigned long long *a, long long llLen, long long i)
+{
+    long long c = 0;
+    unsigned long long ullTmp = 0;
+    while ((c = 2*i+1) < llLen)
+    {
+        if (c+1 < llLen && a[c+1] > a[c])
+            c++;
+        if (a[c] <= a[i])
+            break;
+        ullTmp = a[c];
+        a[c] = a[i];
+        a[i] = ullTmp;
+        i = c;
+    }
+
+    return;
+}
+
+// ----------------------------------------------------------------------------
+
+// both sketches are sorted. walks the union in order until llSize hashes
+// have been seen and counts the ones that are in both.
+long double sketch_jaccard(const unsigned long long *a, long long llLenA,
+                           const unsigned long long *b, long long llLenB, long long llSize)
+{
+    long long i=0, j=0, c=0, u=0;
+    while (u < llSize && (i < llLenA || j < llLenB))
+    {
+        u++;
+        if (i < llLenA && j < llLenB && a[i] == b[j])
+        {
+            i++; j++; c++; continue;
+        }
+        if (j >= llLenB || (i < llLenA && a[i] < b[j]))
+            i++;
+        else
+            j++;
+    }
+
+    if (u == 0)
+        return 0.0;
+
+    return (long double)c / (long double)u;
+}
+
+// ----------------------------------------------------------------------------
+
+// helper function for the stdlib qsort
+int compare (const void * a, const void * b)
+{
+  if ( *(unsigned long long*)a <  *(unsigned long long*)b ) return -1;
+  if ( *(unsigned long long*)a >  *(unsigned long long*)b ) return 1;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// eof